@@ -1,7 +1,28 @@
 #include <stdio.h> // sprintf
+#include <stddef.h> // offsetof
 #include <assert.h>
 #include <iostream>
 #include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#if defined(_MSC_VER)
+#include <intrin.h> // _BitScanForward, __popcnt64
+#endif
+#include <xmmintrin.h> // SSE frustum culling
+#include <emmintrin.h> // SSE2 terrain noise
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h> // VirtualAlloc
+#else
+#include <sys/mman.h> // mmap, mprotect, madvise
+#include <sys/stat.h> // fstat, mkdir
+#include <fcntl.h> // open
+#include <unistd.h> // close
+#include <errno.h>
+#endif
 
 #include "glad\glad.h"
 #include "GLFW\glfw3.h"
@@ -56,9 +77,10 @@ struct Game_input
             Button n2;
             Button n3;
             Button n4;
+            Button n5;
         };
 
-        Button buttons[13];
+        Button buttons[14];
     };
 };
 
@@ -71,12 +93,221 @@ struct Game_memory
 
     uint64_t transient_mem_size;
     void *transient_mem;
+
+    // NOTE(max): both blocks are only reserved, the game commits what it uses
+    bool huge_pages;
+
+    // NOTE(max): from the command line, -seed <n>, -world <dir>, -shadow_maps, -mesher <volume|surface|greedy>,
+    // -vertex_format <float|packed>, -rebuild_budget_us <n> and -stream_radius <n>
+    uint32_t terrain_seed;
+    const char *world_dir;
+    // NOTE(max): the flood fill light already darkens what the sun cannot reach, the cascades are extra
+    bool shadow_maps;
+    // NOTE(max): a Mesher_mode and a Vertex_format. They are copied into the game state on every start, a snapshot
+    // does not keep its own. Chunks keep the format they were meshed with until they are rebuilt.
+    int mesher_mode;
+    int vertex_format;
+    double rebuild_budget_us;
+    int stream_radius;
 };
 
+// NOTE(max): address space is reserved up front and pages are committed when an arena first reaches them
+void *platform_reserve_memory(uint64_t size)
+{
+#if defined(_WIN32)
+    return (VirtualAlloc(0, size, MEM_RESERVE, PAGE_NOACCESS));
+#else
+    void *result = mmap(0, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return ((result == MAP_FAILED) ? 0 : result);
+#endif
+}
+
+// NOTE(max): 0 if the range at base is taken. Memory that is always at the same address can be saved and loaded
+// back without fixing up pointers.
+void *platform_reserve_memory_at(void *base, uint64_t size)
+{
+#if defined(_WIN32)
+    return (VirtualAlloc(base, size, MEM_RESERVE, PAGE_NOACCESS));
+#else
+    void *result = mmap(base, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (result == MAP_FAILED)
+    {
+        return (0);
+    }
+    if (result != base)
+    {
+        munmap(result, size);
+        return (0);
+    }
+    return (result);
+#endif
+}
+
+bool platform_commit_memory(void *memory, uint64_t size)
+{
+#if defined(_WIN32)
+    return (VirtualAlloc(memory, size, MEM_COMMIT, PAGE_READWRITE) != 0);
+#else
+    return (mprotect(memory, size, PROT_READ | PROT_WRITE) == 0);
+#endif
+}
+
+// NOTE(max): only a hint. Windows large pages need SeLockMemoryPrivilege and can not be committed piecemeal,
+// there the bigger commit granularity is all you get.
+void platform_advise_huge_pages(void *memory, uint64_t size)
+{
+#if defined(MADV_HUGEPAGE)
+    madvise(memory, size, MADV_HUGEPAGE);
+#else
+    (void)memory;
+    (void)size;
+#endif
+}
+
+// NOTE(max): read-only view of the whole file, 0 if it can not be opened or is empty
+void *platform_map_file(const char *path, uint64_t *size)
+{
+    *size = 0;
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, 0,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return (0);
+    }
+
+    void *result = 0;
+    LARGE_INTEGER file_size;
+    if (GetFileSizeEx(file, &file_size) && (file_size.QuadPart > 0))
+    {
+        HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+        if (mapping)
+        {
+            result = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        if (result)
+        {
+            *size = (uint64_t)file_size.QuadPart;
+        }
+    }
+    CloseHandle(file);
+    return (result);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return (0);
+    }
+
+    void *result = 0;
+    struct stat st;
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+    {
+        result = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (result == MAP_FAILED)
+        {
+            result = 0;
+        }
+        else
+        {
+            *size = (uint64_t)st.st_size;
+        }
+    }
+    close(fd);
+    return (result);
+#endif
+}
+
+void platform_unmap_file(void *memory, uint64_t size)
+{
+#if defined(_WIN32)
+    (void)size;
+    UnmapViewOfFile(memory);
+#else
+    munmap(memory, (size_t)size);
+#endif
+}
+
+// NOTE(max): puts size bytes of the file from offset at address, which has to be reserved memory. The pages are
+// private, writes do not go back to the file. Windows can not map a view into reserved address space, there the
+// pages are committed and read instead.
+bool platform_map_file_private(const char *path, uint64_t offset, void *address, uint64_t size)
+{
+#if defined(_WIN32)
+    if (!VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE))
+    {
+        return (false);
+    }
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return (false);
+    }
+
+    LARGE_INTEGER start;
+    start.QuadPart = (LONGLONG)offset;
+    bool result = SetFilePointerEx(file, start, 0, FILE_BEGIN) != 0;
+    uint8_t *out = (uint8_t *)address;
+    while (result && (size > 0))
+    {
+        DWORD to_read = (DWORD)std::min(size, (uint64_t)MEMORY_MB(64));
+        DWORD read = 0;
+        result = ReadFile(file, out, to_read, &read, 0) && (read == to_read);
+        out += to_read;
+        size -= to_read;
+    }
+    CloseHandle(file);
+    return (result);
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        return (false);
+    }
+
+    void *result = mmap(address, (size_t)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, (off_t)offset);
+    close(fd);
+    return (result == address);
+#endif
+}
+
+// NOTE(max): true if the directory exists afterwards
+bool platform_make_directory(const char *path)
+{
+#if defined(_WIN32)
+    return (CreateDirectoryA(path, 0) || (GetLastError() == ERROR_ALREADY_EXISTS));
+#else
+    return ((mkdir(path, 0755) == 0) || (errno == EEXIST));
+#endif
+}
+
+// NOTE(max): moves from over to in one step, to is either the old or the new file whatever happens in between
+bool platform_replace_file(const char *from, const char *to)
+{
+#if defined(_WIN32)
+    return (MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0);
+#else
+    return (rename(from, to) == 0);
+#endif
+}
+
+#define MEMORY_COMMIT_GRANULARITY MEMORY_KB(64)
+#define MEMORY_HUGE_PAGE_SIZE MEMORY_MB(2)
+
 struct Memory_arena
 {
     uint8_t *curr;
     uint8_t *end;
+
+    // NOTE(max): 0 when all of [curr, end) is usable. Otherwise pages past it are only reserved
+    // and get committed commit_granularity bytes at a time.
+    uint8_t *committed;
+    uint64_t commit_granularity;
+
+    // NOTE(max): furthest curr has ever been
+    uint8_t *high_water;
 };
 
 #define ALIGN_UP(n, k) (((n) + (k) - 1) & ((~(k)) + 1))
@@ -92,11 +323,55 @@ void *memory_arena_alloc(Memory_arena *arena, int64_t size)
     }
 
     uint8_t *result = arena->curr;
-    arena->curr = (uint8_t *)ALIGN_PTR_UP(result + size, 8);
+    uint8_t *new_curr = (uint8_t *)ALIGN_PTR_UP(result + size, 8);
+
+    if (arena->committed && (arena->committed < new_curr))
+    {
+        uint8_t *commit_end = (uint8_t *)ALIGN_PTR_UP(new_curr, arena->commit_granularity);
+        commit_end = std::min(commit_end, arena->end);
+        if (!platform_commit_memory(arena->committed, commit_end - arena->committed))
+        {
+            return (0);
+        }
+        arena->committed = commit_end;
+    }
+
+    arena->curr = new_curr;
+    arena->high_water = std::max(arena->high_water, new_curr);
 
     return (result);
 }
 
+// NOTE(max): arena over memory that is already committed
+void memory_arena_init(Memory_arena *arena, void *memory, uint64_t size)
+{
+    arena->curr = (uint8_t *)memory;
+    arena->end = (uint8_t *)memory + size;
+    arena->committed = 0;
+    arena->commit_granularity = 0;
+    arena->high_water = arena->curr;
+}
+
+// NOTE(max): arena over memory from platform_reserve_memory, nothing of it is committed yet
+void memory_arena_init_reserved(Memory_arena *arena, void *memory, uint64_t size, bool huge_pages)
+{
+    assert((uint64_t)memory % MEMORY_COMMIT_GRANULARITY == 0);
+
+    memory_arena_init(arena, memory, size);
+    arena->committed = (uint8_t *)memory;
+    arena->commit_granularity = huge_pages ? MEMORY_HUGE_PAGE_SIZE : MEMORY_COMMIT_GRANULARITY;
+
+    if (huge_pages)
+    {
+        platform_advise_huge_pages(memory, size);
+    }
+}
+
+uint64_t memory_arena_committed_size(Memory_arena *arena, void *base)
+{
+    return (arena->committed ? (uint64_t)(arena->committed - (uint8_t *)base) : (uint64_t)(arena->end - (uint8_t *)base));
+}
+
 inline void *memory_arena_get_cursor(Memory_arena *arena)
 {
     return (arena->curr);
@@ -108,12 +383,77 @@ inline void memory_arena_set_cursor(Memory_arena *arena, void *cursor)
     arena->curr = (uint8_t *)cursor;
 }
 
+inline int ctz32(uint32_t x)
+{
+    assert(x != 0);
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward(&idx, x);
+    return ((int)idx);
+#else
+    return (__builtin_ctz(x));
+#endif
+}
+
+inline int ctz64(uint64_t x)
+{
+    assert(x != 0);
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return ((int)idx);
+#else
+    return (__builtin_ctzll(x));
+#endif
+}
+
+inline int popcount64(uint64_t x)
+{
+#if defined(_MSC_VER)
+    return ((int)__popcnt64(x));
+#else
+    return (__builtin_popcountll(x));
+#endif
+}
+
+// NOTE(max): SSE2 has no 32-bit multiply low, do the even and odd lanes with _mm_mul_epu32 and interleave them
+inline __m128i simd_mullo_epi32(__m128i a, __m128i b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return (_mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                               _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0))));
+}
+
+inline __m128 simd_floor(__m128 x)
+{
+    __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return (_mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f))));
+}
+
+// NOTE(max): mask lanes are all ones or all zeros, takes a where the mask is set
+inline __m128i simd_select_epi32(__m128i mask, __m128i a, __m128i b)
+{
+    return (_mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b)));
+}
+
+inline __m128i simd_min_epi32(__m128i a, __m128i b)
+{
+    return (simd_select_epi32(_mm_cmplt_epi32(a, b), a, b));
+}
+
+inline __m128i simd_max_epi32(__m128i a, __m128i b)
+{
+    return (simd_select_epi32(_mm_cmpgt_epi32(a, b), a, b));
+}
+
 enum Block_type
 {
     BLOCK_GRASS,
     BLOCK_DIRT,
     BLOCK_STONE,
     BLOCK_SNOW,
+    BLOCK_LAMP,
     BLOCK_AIR,
    
     BLOCK_TYPE_COUNT = BLOCK_AIR,
@@ -125,19 +465,112 @@ Vec3f Block_colors[BLOCK_TYPE_COUNT] =
 	Vec3f(0, 1, 0),
 	Vec3f(130 / 255.0f, 108 / 255.0f, 47 / 255.0f),
 	Vec3f(0.4f, 0.4f, 0.4f),
-	Vec3f(1, 1, 1)
+	Vec3f(1, 1, 1),
+	Vec3f(1.0f, 0.85f, 0.45f)
+};
+
+// NOTE(max): block light a block gives off, 0..LIGHT_MAX, air included
+uint8_t Block_light_emission[BLOCK_TYPE_COUNT + 1] =
+{
+	0, 0, 0, 0, 15, 0
+};
+
+enum Face
+{
+    FACE_BOTTOM, // -y
+    FACE_TOP,    // +y
+    FACE_NORTH,  // -z
+    FACE_SOUTH,  // +z
+    FACE_WEST,   // -x
+    FACE_EAST,   // +x
+
+    FACE_COUNT,
+};
+
+// NOTE(max): faces come in pairs, the opposite of a face is the other one of its pair
+inline int face_opposite(int face)
+{
+    return (face ^ 1);
+}
+
+int Face_normals[FACE_COUNT][3] =
+{
+    { 0, -1,  0},
+    { 0,  1,  0},
+    { 0,  0, -1},
+    { 0,  0,  1},
+    {-1,  0,  0},
+    { 1,  0,  0},
 };
 
+// NOTE(max): bit FACE_COUNT * a + b (and FACE_COUNT * b + a) is set when air inside the chunk connects its faces
+// a and b, which means the chunk behind b can be seen through this one from the chunk behind a
+#define FACE_LINKS_ALL (~0ull >> (64 - FACE_COUNT * FACE_COUNT))
+
+inline bool face_links_connected(uint64_t links, int a, int b)
+{
+    return ((links >> (FACE_COUNT * a + b)) & 1);
+}
+
+enum Vertex_format
+{
+    VERTEX_FORMAT_FLOAT,  // see Float_vertex
+    VERTEX_FORMAT_PACKED, // one uint32_t, see pack_vertex
+
+    VERTEX_FORMAT_COUNT,
+};
+
+#define DEFAULT_VERTEX_FORMAT VERTEX_FORMAT_PACKED
+
+// NOTE(max): packed vertex layout, decoded in mesh.vert and meshShadowMap.vert
+// bits  0..4   x, position inside the chunk (0..CHUNK_DIM)
+// bits  5..9   y
+// bits 10..14  z
+// bits 15..17  face (Face), gives the normal
+// bits 18..23  block type
+// bits 24..31  light of the block in front of the face, sky light in the high 4 bits
+#define PACKED_VERTEX_POS_BITS 5
+#define PACKED_VERTEX_TYPE_BITS 6
+
+inline uint32_t pack_vertex(int x, int y, int z, int face, int type, int light)
+{
+    return ((uint32_t)x | ((uint32_t)y << 5) | ((uint32_t)z << 10) | ((uint32_t)face << 15) | ((uint32_t)type << 18) |
+            ((uint32_t)light << 24));
+}
+
+static_assert(BLOCK_TYPE_COUNT <= (1 << PACKED_VERTEX_TYPE_BITS), "block type does not fit in a packed vertex");
+static_assert(sizeof(Vec3f) == 3 * sizeof(float), "Block_colors are uploaded as a vec3 array");
+
+// NOTE(max): vertices are in the Gpu_buffer of the format, npages pages from first_page. No slot while npages is 0.
 struct Mesh
 {
     int num_of_vs;
-    GLuint vao;
-    GLuint vbo;
+    Vertex_format format;
+    uint32_t first_page;
+    uint32_t npages;
 };
 
 #define CHUNK_DIM_LOG2 4
 #define CHUNK_DIM (1 << 4)
 #define BLOCKS_IN_CHUNK ((CHUNK_DIM) * (CHUNK_DIM) * (CHUNK_DIM))
+static_assert(CHUNK_DIM < (1 << PACKED_VERTEX_POS_BITS), "chunk positions do not fit in a packed vertex");
+
+#define CHUNK_PALETTE_MAX (1 << PACKED_VERTEX_TYPE_BITS)
+
+// NOTE(max): set when chunk_set_block checks the occupancy masks against the blocks after every change (slow)
+#define CHUNK_VALIDATE_OCCUPANCY 0
+
+// NOTE(max): solid (non-air) blocks as bits, kept in sync by chunk_set_block. Bit i of solid is block i, so the
+// x row of (y, z) is 16 bits of solid and each word holds four of them. columns_y[CHUNK_DIM*z + x] has bit y set
+// and columns_z[CHUNK_DIM*y + x] bit z.
+struct Chunk_occupancy
+{
+    uint64_t solid[BLOCKS_IN_CHUNK / 64];
+    uint16_t columns_y[CHUNK_DIM * CHUNK_DIM];
+    uint16_t columns_z[CHUNK_DIM * CHUNK_DIM];
+};
+
+static_assert(CHUNK_DIM == 16, "occupancy rows and columns are stored in uint16_t");
 
 struct Chunk
 {
@@ -145,421 +578,5534 @@ struct Chunk
     int y;
     int z;
     Chunk *next;
+    Chunk *prev;
+    // NOTE(max): loaded chunks next to this one by Face, kept up to date by world_add_chunk and world_remove_chunk
+    Chunk *neighbours[FACE_COUNT];
     int nblocks;
-    uint8_t *blocks;
-    Mesh meshes[BLOCK_TYPE_COUNT];
+
+    // NOTE(max): palette compressed blocks, go through chunk_get_block and chunk_set_block. Block i is
+    // palette[index i], indices are bits wide (0, 1, 2, 4 or 8). With 0 bits the whole chunk is palette[0]
+    // and indices is 0.
+    uint8_t bits;
+    uint8_t palette_count;
+    uint8_t palette[CHUNK_PALETTE_MAX];
+    uint64_t *indices;
+    Chunk_occupancy occupancy;
+    // NOTE(max): sky light in the high and block light in the low 4 bits of every block, see Light_engine. While
+    // the whole chunk has the same light it is light_fill and light is 0, otherwise light is BLOCKS_IN_CHUNK bytes
+    // from the Block_storage.
+    uint8_t *light;
+    uint8_t light_fill;
+
+    Mesh mesh;
+
+    // NOTE(max): bumped every time a rebuild is started, results of older mesh jobs are dropped
+    uint32_t mesh_generation;
+    // NOTE(max): mesh_generation of the last rebuild that made it to the GPU
+    uint32_t uploaded_generation;
+    // NOTE(max): which faces see each other through the chunk (chunk_face_links), from the same rebuild as the
+    // mesh. Everything is linked until the first rebuild. cave_frame is the last frame cave_cull_chunks reached it.
+    uint64_t face_links;
+    uint32_t cave_frame;
+    // NOTE(max): set while the chunk is in the rebuild queue, so it is queued at most once
+    bool dirty;
+    // NOTE(max): false until the streamer filled in the terrain, edits wait for it
+    bool generated;
+    // NOTE(max): edited since it was generated or loaded, it is saved when it is unloaded
+    bool modified;
+
+    // NOTE(max): slot in the chunk pool. generation is bumped when the slot is freed, which invalidates
+    // every Chunk_handle to the old chunk. next_free links free slots.
+    uint32_t pool_index;
+    uint32_t generation;
+    uint32_t next_free;
 };
 
-#define REBUILD_STACK_SIZE 128
-struct World
+// NOTE(max): safe to keep across frames, chunk_pool_get returns 0 once the chunk was removed
+struct Chunk_handle
 {
-    Chunk *next;
+    uint32_t index;
+    uint32_t generation;
+};
+
+// NOTE(max): fixed-size slots (the blocks are in Block_storage) in pages of CHUNK_POOL_PAGE_SIZE that are allocated from the arena as the pool grows
+// and never given back. Freed slots go on a free list and are reused first.
+#define CHUNK_POOL_PAGE_SIZE_LOG2 8
+#define CHUNK_POOL_PAGE_SIZE (1 << CHUNK_POOL_PAGE_SIZE_LOG2)
+#define CHUNK_POOL_MAX_PAGES 4096
+#define CHUNK_POOL_NO_SLOT 0xFFFFFFFFu
 
-    int rebuild_stack_top;
-    Chunk *rebuild_stack[REBUILD_STACK_SIZE];
+struct Chunk_pool
+{
+    uint32_t nslots;
+    uint32_t first_free;
+    int npages;
+    Chunk *pages[CHUNK_POOL_MAX_PAGES];
 };
 
-void world_push_chunk_for_rebuild(World *w, Chunk *c)
+void chunk_pool_init(Chunk_pool *pool)
 {
-    assert(w->rebuild_stack_top < REBUILD_STACK_SIZE);
-    w->rebuild_stack[w->rebuild_stack_top++] = c;
+    pool->nslots = 0;
+    pool->first_free = CHUNK_POOL_NO_SLOT;
+    pool->npages = 0;
 }
 
-Chunk *world_pop_chunk_for_rebuild(World *w)
+inline Chunk *chunk_pool_slot(Chunk_pool *pool, uint32_t index)
 {
-    assert(w->rebuild_stack_top > 0);
-    return w->rebuild_stack[--w->rebuild_stack_top];
+    assert(index < pool->nslots);
+    return (&pool->pages[index >> CHUNK_POOL_PAGE_SIZE_LOG2][index & (CHUNK_POOL_PAGE_SIZE - 1)]);
 }
 
-Chunk *world_add_chunk(World *world, Memory_arena *arena, int x, int y, int z)
+// NOTE(max): only the pool fields are set, the rest is up to the caller
+Chunk *chunk_pool_alloc(Chunk_pool *pool, Memory_arena *arena)
 {
-    Chunk *result = (Chunk *)memory_arena_alloc(arena, sizeof(Chunk) + (CHUNK_DIM * CHUNK_DIM * CHUNK_DIM));
-
-    if (result)
+    if (pool->first_free != CHUNK_POOL_NO_SLOT)
     {
-        result->x = x;
-        result->y = y;
-        result->z = z;
-        result->next = world->next;
-        result->nblocks = 0;
-        result->blocks = (uint8_t *)&result[1];
+        Chunk *result = chunk_pool_slot(pool, pool->first_free);
+        pool->first_free = result->next_free;
+        result->next_free = CHUNK_POOL_NO_SLOT;
+        return (result);
+    }
 
-        for (int i = 0; i < BLOCKS_IN_CHUNK; i++)
+    if (pool->nslots == (uint32_t)pool->npages * CHUNK_POOL_PAGE_SIZE)
+    {
+        if (pool->npages == CHUNK_POOL_MAX_PAGES)
         {
-            result->blocks[i] = BLOCK_AIR;
+            return (0);
         }
 
-        for (int i = 0; i < BLOCK_TYPE_COUNT; i++)
+        Chunk *page = (Chunk *)memory_arena_alloc(arena, CHUNK_POOL_PAGE_SIZE * sizeof(Chunk));
+        if (!page)
         {
-            result->meshes[i].num_of_vs = 0;
-            result->meshes[i].vao = 0;
-            result->meshes[i].vbo = 0;
+            return (0);
         }
-
-        world->next = result;
+        pool->pages[pool->npages++] = page;
     }
 
+    uint32_t index = pool->nslots++;
+    Chunk *result = chunk_pool_slot(pool, index);
+    result->pool_index = index;
+    // NOTE(max): a zeroed Chunk_handle never matches a live chunk
+    result->generation = 1;
+    result->next_free = CHUNK_POOL_NO_SLOT;
+
     return (result);
 }
 
-struct Game_state
+void chunk_pool_free(Chunk_pool *pool, Chunk *c)
 {
-    Memory_arena arena;
+    assert(c->next_free == CHUNK_POOL_NO_SLOT);
+    c->generation++;
+    c->next_free = pool->first_free;
+    pool->first_free = c->pool_index;
+}
 
-	Skybox skybox;
-    ShaderProgram skyboxSP;
-	ShaderProgram sunSP;
-	ShaderProgram imageSP;
-	ShaderProgram inventoryBlockSP;
-	ShaderProgram mesh_sp;
-	ShaderProgram meshShadowMapSP;
-	ShadowMap shadowMap1;
-	ShadowMap shadowMap2;
-	ShadowMap shadowMap3;
-	ShadowMap shadowMap4;
-	Texture sunTexture;
-	Texture inventoryBarTexture;
-	Texture crossTexture;
-	GLuint cubeVAO;
-    GLuint cubeVBO;
-	GLuint squareVAO;
-	GLuint squareVBO;
+inline Chunk_handle chunk_handle(Chunk *c)
+{
+    Chunk_handle result = { c->pool_index, c->generation };
+    return (result);
+}
 
-    Vec3f cam_pos;
-    Vec3f cam_view_dir;
-    Vec3f cam_move_dir;
-    Vec3f cam_up;
-    Vec3f cam_rot;
+inline Chunk *chunk_pool_get(Chunk_pool *pool, Chunk_handle h)
+{
+    if (h.index >= pool->nslots)
+    {
+        return (0);
+    }
 
-    uint8_t block_to_place;
+    Chunk *result = chunk_pool_slot(pool, h.index);
+    return ((result->generation == h.generation) ? result : 0);
+}
 
-    World world;
-};
+// NOTE(max): packed index arrays of chunks. Class k holds arrays of (1 << k) bit indices, freed arrays go on
+// the free list of their class and are reused first. Light arrays are one byte per block and share the 8 bit class.
+#define BLOCK_STORAGE_CLASS_COUNT 4
 
-struct Raycast_result
+struct Block_storage
 {
-    bool collision;
-    float last_t;
-    Chunk *chunk;
-
-    int i;
-    int j;
-    int k;
-    
-    int last_i;
-    int last_j;
-    int last_k;
+    Memory_arena *arena;
+    uint64_t *free_lists[BLOCK_STORAGE_CLASS_COUNT];
+    uint64_t bytes_in_use;
 };
 
-Raycast_result raycast(World *world, Vec3f pos, Vec3f view_dir)
+inline uint64_t block_storage_size(int bits)
 {
-    Raycast_result result = {};
+    return (BLOCKS_IN_CHUNK * bits / 8);
+}
 
-    bool collision = false;
-    float last_t = 0.0f;
-    
-    float tile_dim = 1.0f;
-    float tolerance = 0.001f;
+uint64_t *block_storage_alloc(Block_storage *storage, int bits)
+{
+    int k = ctz32(bits);
+    assert(k < BLOCK_STORAGE_CLASS_COUNT);
 
-    float start_x = pos.x;
-    float start_y = pos.y;
-    float start_z = pos.z;
+    uint64_t *result = storage->free_lists[k];
+    if (result)
+    {
+        storage->free_lists[k] = (uint64_t *)result[0];
+    }
+    else
+    {
+        result = (uint64_t *)memory_arena_alloc(storage->arena, block_storage_size(bits));
+        if (!result)
+        {
+            return (0);
+        }
+    }
 
-    float max_ray_len = 10.0f;
-    Vec3f end_point = pos + max_ray_len * view_dir;
-    float end_x = end_point.x;
-    float end_y = end_point.y;
-    float end_z = end_point.z;
+    storage->bytes_in_use += block_storage_size(bits);
+    return (result);
+}
 
-    int i = (int)floorf(start_x / tile_dim);
-    int j = (int)floorf(start_y / tile_dim);
-    int k = (int)floorf(start_z / tile_dim);
+void block_storage_free(Block_storage *storage, uint64_t *indices, int bits)
+{
+    int k = ctz32(bits);
+    indices[0] = (uint64_t)storage->free_lists[k];
+    storage->free_lists[k] = indices;
+    storage->bytes_in_use -= block_storage_size(bits);
+}
 
-    int i_end = (int)floorf(end_x / tile_dim);
-    int j_end = (int)floorf(end_y / tile_dim);
-    int k_end = (int)floorf(end_z / tile_dim);
+inline bool chunk_is_solid_idx(Chunk *c, int idx)
+{
+    return ((c->occupancy.solid[idx >> 6] >> (idx & 63)) & 1);
+}
 
-    int di = (start_x < end_x) ? 1 : ((start_x > end_x) ? -1 : 0);
-    int dj = (start_y < end_y) ? 1 : ((start_y > end_y) ? -1 : 0);
-    int dk = (start_z < end_z) ? 1 : ((start_z > end_z) ? -1 : 0);
+inline bool chunk_is_solid(Chunk *c, int x, int y, int z)
+{
+    return (chunk_is_solid_idx(c, CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x));
+}
 
-    float min_x = tile_dim * floorf(start_x / tile_dim);
-    float max_x = min_x + tile_dim;
-    float t_x = INFINITY;
-    if (fabs(end_x - start_x) > tolerance)
-    {
-        t_x = ((start_x < end_x) ? (max_x - start_x) : (start_x - min_x)) / fabsf(end_x - start_x);
-    }
+// NOTE(max): bit x set for solid blocks of the row
+inline uint16_t chunk_row_x(Chunk *c, int y, int z)
+{
+    int idx = CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z;
+    return ((uint16_t)(c->occupancy.solid[idx >> 6] >> (idx & 63)));
+}
 
-    float min_y = tile_dim * floorf(start_y / tile_dim);
-    float max_y = min_y + tile_dim;
-    float t_y = INFINITY;
-    if (fabs(end_y - start_y) > tolerance)
-    {
-        t_y = ((start_y < end_y) ? (max_y - start_y) : (start_y - min_y)) / fabsf(end_y - start_y);
-    }
+// NOTE(max): bit y set for solid blocks of the column
+inline uint16_t chunk_column_y(Chunk *c, int x, int z)
+{
+    return (c->occupancy.columns_y[CHUNK_DIM * z + x]);
+}
 
-    float min_z = tile_dim * floorf(start_z / tile_dim);
-    float max_z = min_z + tile_dim;
-    float t_z = INFINITY;
-    if (fabs(end_z - start_z) > tolerance)
-    {
-        t_z = ((start_z < end_z) ? (max_z - start_z) : (start_z - min_z)) / fabsf(end_z - start_z);
-    }
+// NOTE(max): bit z set for solid blocks of the column
+inline uint16_t chunk_column_z(Chunk *c, int x, int y)
+{
+    return (c->occupancy.columns_z[CHUNK_DIM * y + x]);
+}
+
+void chunk_occupancy_set(Chunk_occupancy *o, int idx, bool solid)
+{
+    int x = idx & (CHUNK_DIM - 1);
+    int z = (idx >> CHUNK_DIM_LOG2) & (CHUNK_DIM - 1);
+    int y = idx >> (2 * CHUNK_DIM_LOG2);
 
-    float dt_x = INFINITY;
-    if (fabs(end_x - start_x) > tolerance)
+    if (solid)
     {
-        dt_x = tile_dim / fabsf(end_x - start_x);
+        o->solid[idx >> 6] |= 1ull << (idx & 63);
+        o->columns_y[CHUNK_DIM * z + x] |= (uint16_t)(1 << y);
+        o->columns_z[CHUNK_DIM * y + x] |= (uint16_t)(1 << z);
     }
-
-    float dt_y = INFINITY;
-    if (fabs(end_y - start_y) > tolerance)
+    else
     {
-        dt_y = tile_dim / fabsf(end_y - start_y);
+        o->solid[idx >> 6] &= ~(1ull << (idx & 63));
+        o->columns_y[CHUNK_DIM * z + x] &= (uint16_t)~(1 << y);
+        o->columns_z[CHUNK_DIM * y + x] &= (uint16_t)~(1 << z);
     }
+}
 
-    float dt_z = INFINITY;
-    if (fabs(end_z - start_z) > tolerance)
+inline uint8_t chunk_get_block_idx(Chunk *c, int idx)
+{
+    if (c->bits == 0)
     {
-        dt_z = tile_dim / fabsf(end_z - start_z);
+        return (c->palette[0]);
     }
 
-    Chunk *chunk = 0;
-    int last_di = 0;
-    int last_dj = 0;
-    int last_dk = 0;
+    // NOTE(max): bits is a power of two, so an index never straddles two words
+    uint32_t bit = (uint32_t)idx * c->bits;
+    uint32_t index = (uint32_t)(c->indices[bit >> 6] >> (bit & 63)) & ((1u << c->bits) - 1);
+    return (c->palette[index]);
+}
+
+inline uint8_t chunk_get_block(Chunk *c, int x, int y, int z)
+{
+    return (chunk_get_block_idx(c, CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x));
+}
+
+// NOTE(max): follows the neighbour links until x, y and z are inside the chunk and rewrites them to coordinates
+// in the chunk that is returned, 0 if a chunk on the way is not loaded
+Chunk *chunk_neighbour_at(Chunk *c, int *x, int *y, int *z)
+{
+    for (; c && (*x < 0); *x += CHUNK_DIM) c = c->neighbours[FACE_WEST];
+    for (; c && (*x >= CHUNK_DIM); *x -= CHUNK_DIM) c = c->neighbours[FACE_EAST];
+    for (; c && (*y < 0); *y += CHUNK_DIM) c = c->neighbours[FACE_BOTTOM];
+    for (; c && (*y >= CHUNK_DIM); *y -= CHUNK_DIM) c = c->neighbours[FACE_TOP];
+    for (; c && (*z < 0); *z += CHUNK_DIM) c = c->neighbours[FACE_NORTH];
+    for (; c && (*z >= CHUNK_DIM); *z -= CHUNK_DIM) c = c->neighbours[FACE_SOUTH];
+    return (c);
+}
+
+// NOTE(max): like chunk_get_block but x, y and z may be outside of the chunk, blocks of chunks that are not
+// loaded are air
+inline uint8_t chunk_get_block_near(Chunk *c, int x, int y, int z)
+{
+    Chunk *n = chunk_neighbour_at(c, &x, &y, &z);
+    return (n ? chunk_get_block(n, x, y, z) : (uint8_t)BLOCK_AIR);
+}
+
+inline bool chunk_is_solid_near(Chunk *c, int x, int y, int z)
+{
+    Chunk *n = chunk_neighbour_at(c, &x, &y, &z);
+    return (n ? chunk_is_solid(n, x, y, z) : false);
+}
+
+// NOTE(max): decodes all blocks to out, laid out as blocks[CHUNK_DIM*CHUNK_DIM*y + CHUNK_DIM*z + x]
+void chunk_copy_blocks(Chunk *c, uint8_t *out)
+{
+    if (c->bits == 0)
+    {
+        memset(out, c->palette[0], BLOCKS_IN_CHUNK);
+        return;
+    }
+
+    int bits = c->bits;
+    int per_word = 64 / bits;
+    uint64_t mask = (1ull << bits) - 1;
+    int nwords = BLOCKS_IN_CHUNK / per_word;
+    for (int w = 0; w < nwords; w++)
+    {
+        uint64_t word = c->indices[w];
+        for (int i = 0; i < per_word; i++)
+        {
+            *out++ = c->palette[word & mask];
+            word >>= bits;
+        }
+    }
+}
+
+// NOTE(max): the masks agree with the blocks and with nblocks
+bool chunk_occupancy_valid(Chunk *c)
+{
+    uint8_t blocks[BLOCKS_IN_CHUNK];
+    chunk_copy_blocks(c, blocks);
+
+    int nsolid = 0;
+    for (int w = 0; w < BLOCKS_IN_CHUNK / 64; w++)
+    {
+        nsolid += popcount64(c->occupancy.solid[w]);
+    }
+    if (nsolid != c->nblocks)
+    {
+        return (false);
+    }
+
+    for (int y = 0; y < CHUNK_DIM; y++)
+    {
+        for (int z = 0; z < CHUNK_DIM; z++)
+        {
+            for (int x = 0; x < CHUNK_DIM; x++)
+            {
+                bool solid = blocks[CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x] != BLOCK_AIR;
+                if ((chunk_is_solid(c, x, y, z) != solid) ||
+                    (((chunk_row_x(c, y, z) >> x) & 1) != solid) ||
+                    (((chunk_column_y(c, x, z) >> y) & 1) != solid) ||
+                    (((chunk_column_z(c, x, y) >> z) & 1) != solid))
+                {
+                    return (false);
+                }
+            }
+        }
+    }
+
+    return (true);
+}
+
+// NOTE(max): replaces the palette and indices of the chunk with the types used in blocks plus extra_type
+// (if it is not -1), packed with the smallest width that fits. Occupancy and nblocks are not touched.
+bool chunk_pack_blocks(Block_storage *storage, Chunk *c, const uint8_t *blocks, int extra_type)
+{
+    bool used[CHUNK_PALETTE_MAX] = {};
+    for (int i = 0; i < BLOCKS_IN_CHUNK; i++)
+    {
+        used[blocks[i]] = true;
+    }
+    if (extra_type >= 0)
+    {
+        used[extra_type] = true;
+    }
+
+    uint8_t palette_count = 0;
+    uint8_t palette[CHUNK_PALETTE_MAX];
+    uint8_t palette_index[CHUNK_PALETTE_MAX];
+    for (int t = 0; t < CHUNK_PALETTE_MAX; t++)
+    {
+        if (used[t])
+        {
+            palette_index[t] = palette_count;
+            palette[palette_count++] = (uint8_t)t;
+        }
+    }
+
+    int bits = 0;
+    while ((1 << bits) < palette_count)
+    {
+        bits = bits ? 2 * bits : 1;
+    }
+
+    uint64_t *indices = 0;
+    if (bits)
+    {
+        indices = block_storage_alloc(storage, bits);
+        if (!indices)
+        {
+            return (false);
+        }
+
+        int per_word = 64 / bits;
+        int nwords = BLOCKS_IN_CHUNK / per_word;
+        for (int w = 0; w < nwords; w++)
+        {
+            uint64_t word = 0;
+            for (int i = per_word - 1; i >= 0; i--)
+            {
+                word = (word << bits) | palette_index[blocks[w * per_word + i]];
+            }
+            indices[w] = word;
+        }
+    }
+
+    if (c->indices)
+    {
+        block_storage_free(storage, c->indices, c->bits);
+    }
+
+    c->bits = (uint8_t)bits;
+    c->palette_count = palette_count;
+    memcpy(c->palette, palette, palette_count);
+    c->indices = indices;
+
+    return (true);
+}
+
+bool chunk_repack(Block_storage *storage, Chunk *c, int extra_type)
+{
+    uint8_t blocks[BLOCKS_IN_CHUNK];
+    chunk_copy_blocks(c, blocks);
+
+    return (chunk_pack_blocks(storage, c, blocks, extra_type));
+}
+
+// NOTE(max): blocks laid out as in chunk_copy_blocks
+bool chunk_set_all_blocks(Block_storage *storage, Chunk *c, const uint8_t *blocks)
+{
+    if (!chunk_pack_blocks(storage, c, blocks, -1))
+    {
+        return (false);
+    }
+
+    memset(&c->occupancy, 0, sizeof(c->occupancy));
+    c->nblocks = 0;
+    for (int i = 0; i < BLOCKS_IN_CHUNK; i++)
+    {
+        if (blocks[i] != BLOCK_AIR)
+        {
+            chunk_occupancy_set(&c->occupancy, i, true);
+            c->nblocks++;
+        }
+    }
+
+    return (true);
+}
+
+// NOTE(max): keeps nblocks up to date. The indices only get wider when the palette is full and every entry is in use.
+bool chunk_set_block_idx(Block_storage *storage, Chunk *c, int idx, uint8_t type)
+{
+    assert(type < CHUNK_PALETTE_MAX);
+
+    uint8_t old_type = chunk_get_block_idx(c, idx);
+    if (old_type == type)
+    {
+        return (true);
+    }
+
+    int index = -1;
+    for (int i = 0; i < c->palette_count; i++)
+    {
+        if (c->palette[i] == type)
+        {
+            index = i;
+            break;
+        }
+    }
+
+    if (index < 0)
+    {
+        if (c->palette_count == (1 << c->bits))
+        {
+            if (!chunk_repack(storage, c, type))
+            {
+                return (false);
+            }
+
+            for (int i = 0; i < c->palette_count; i++)
+            {
+                if (c->palette[i] == type)
+                {
+                    index = i;
+                    break;
+                }
+            }
+        }
+        else
+        {
+            index = c->palette_count++;
+            c->palette[index] = type;
+        }
+    }
+    assert(index >= 0);
+
+    if (c->bits)
+    {
+        uint32_t bit = (uint32_t)idx * c->bits;
+        uint64_t mask = ((1ull << c->bits) - 1) << (bit & 63);
+        uint64_t *word = &c->indices[bit >> 6];
+        *word = (*word & ~mask) | ((uint64_t)index << (bit & 63));
+    }
+
+    c->nblocks += (type != BLOCK_AIR) - (old_type != BLOCK_AIR);
+    if ((type != BLOCK_AIR) != (old_type != BLOCK_AIR))
+    {
+        chunk_occupancy_set(&c->occupancy, idx, type != BLOCK_AIR);
+    }
+
+#if CHUNK_VALIDATE_OCCUPANCY
+    assert(chunk_occupancy_valid(c));
+#endif
+
+    return (true);
+}
+
+inline bool chunk_set_block(Block_storage *storage, Chunk *c, int x, int y, int z, uint8_t type)
+{
+    return (chunk_set_block_idx(storage, c, CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x, type));
+}
+
+#define LIGHT_MAX 15
+#define LIGHT_SKY_SHIFT 4
+#define LIGHT_ARRAY_BITS 8
+
+inline uint8_t chunk_get_light_idx(Chunk *c, int idx)
+{
+    return (c->light ? c->light[idx] : c->light_fill);
+}
+
+// NOTE(max): the chunk gets its own light array the first time a block differs from the fill
+bool chunk_set_light_idx(Block_storage *storage, Chunk *c, int idx, uint8_t light)
+{
+    if (!c->light)
+    {
+        if (light == c->light_fill)
+        {
+            return (true);
+        }
+        c->light = (uint8_t *)block_storage_alloc(storage, LIGHT_ARRAY_BITS);
+        if (!c->light)
+        {
+            return (false);
+        }
+        memset(c->light, c->light_fill, BLOCKS_IN_CHUNK);
+    }
+    c->light[idx] = light;
+
+    return (true);
+}
+
+void chunk_fill_light(Block_storage *storage, Chunk *c, uint8_t light)
+{
+    if (c->light)
+    {
+        block_storage_free(storage, (uint64_t *)c->light, LIGHT_ARRAY_BITS);
+        c->light = 0;
+    }
+    c->light_fill = light;
+}
+
+// NOTE(max): light laid out like the blocks, a chunk with the same light everywhere does not keep an array
+bool chunk_set_all_light(Block_storage *storage, Chunk *c, uint8_t *light)
+{
+    bool uniform = true;
+    for (int i = 1; uniform && (i < BLOCKS_IN_CHUNK); i++)
+    {
+        uniform = (light[i] == light[0]);
+    }
+
+    chunk_fill_light(storage, c, light[0]);
+    if (!uniform)
+    {
+        c->light = (uint8_t *)block_storage_alloc(storage, LIGHT_ARRAY_BITS);
+        if (!c->light)
+        {
+            return (false);
+        }
+        memcpy(c->light, light, BLOCKS_IN_CHUNK);
+    }
+
+    return (true);
+}
+
+void chunk_copy_light(Chunk *c, uint8_t *out)
+{
+    if (c->light)
+    {
+        memcpy(out, c->light, BLOCKS_IN_CHUNK);
+    }
+    else
+    {
+        memset(out, c->light_fill, BLOCKS_IN_CHUNK);
+    }
+}
+
+// NOTE(max): planes (a, b, c, d) of a projection * view matrix, a point is inside when a*x + b*y + c*z + d >= 0.
+// Works for the perspective camera and for the orthographic cascades alike.
+struct Frustum
+{
+    float planes[6][4];
+};
+
+void frustum_from_matrix(Frustum *f, const glm::mat4 &m)
+{
+    // NOTE(max): glm is column-major, row r of the matrix is (m[0][r], m[1][r], m[2][r], m[3][r])
+    for (int r = 0; r < 3; r++)
+    {
+        for (int k = 0; k < 4; k++)
+        {
+            f->planes[2 * r + 0][k] = m[k][3] + m[k][r];
+            f->planes[2 * r + 1][k] = m[k][3] - m[k][r];
+        }
+    }
+}
+
+bool frustum_test_chunk(Frustum *f, int chunk_x, int chunk_y, int chunk_z)
+{
+    float min[3] = { (float)(chunk_x * CHUNK_DIM), (float)(chunk_y * CHUNK_DIM), (float)(chunk_z * CHUNK_DIM) };
+    for (int p = 0; p < 6; p++)
+    {
+        float dist = f->planes[p][3];
+        for (int a = 0; a < 3; a++)
+        {
+            float n = f->planes[p][a];
+            dist += n * (min[a] + ((n > 0.0f) ? CHUNK_DIM : 0.0f));
+        }
+
+        if (dist < 0.0f)
+        {
+            return (false);
+        }
+    }
+
+    return (true);
+}
+
+// NOTE(max): open addressing (linear probing) hash map from packed chunk coordinates to chunks.
+// Slot with chunk == 0 is empty. Capacity is always a power of two.
+struct Chunk_index_slot
+{
+    uint64_t key;
+    Chunk *chunk;
+};
+
+#define CHUNK_INDEX_INITIAL_CAPACITY 256
+
+#define REBUILD_QUEUE_INITIAL_CAPACITY 256
+struct World
+{
+    Chunk *next;
+    int nchunks;
+    Chunk_pool pool;
+    Block_storage block_storage;
+
+    int index_capacity;
+    Chunk_index_slot *index;
+
+    // NOTE(max): unordered, world_pop_chunks_for_rebuild picks the most important entries.
+    // Grows like the index, the old array stays in the arena.
+    int rebuild_queue_count;
+    int rebuild_queue_capacity;
+    Chunk_handle *rebuild_queue;
+};
+
+// NOTE(max): 21 bits per axis, chunk coordinates must be in [-2^20, 2^20)
+inline uint64_t chunk_index_key(int x, int y, int z)
+{
+    uint64_t mask = (1ull << 21) - 1;
+    return (((uint64_t)x & mask) | (((uint64_t)y & mask) << 21) | (((uint64_t)z & mask) << 42));
+}
+
+inline uint32_t chunk_index_hash(uint64_t key)
+{
+    // NOTE(max): fibonacci hashing, take the high bits
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+void chunk_index_insert(Chunk_index_slot *index, int capacity, uint64_t key, Chunk *chunk)
+{
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t slot = chunk_index_hash(key) & mask;
+    while (index[slot].chunk != 0)
+    {
+        assert(index[slot].key != key);
+        slot = (slot + 1) & mask;
+    }
+
+    index[slot].key = key;
+    index[slot].chunk = chunk;
+}
+
+bool world_init(World *w, Memory_arena *arena)
+{
+    w->next = 0;
+    w->nchunks = 0;
+    chunk_pool_init(&w->pool);
+
+    w->block_storage = {};
+    w->block_storage.arena = arena;
+
+    w->rebuild_queue_count = 0;
+    w->rebuild_queue_capacity = REBUILD_QUEUE_INITIAL_CAPACITY;
+    w->rebuild_queue = (Chunk_handle *)memory_arena_alloc(arena, w->rebuild_queue_capacity * sizeof(Chunk_handle));
+    if (!w->rebuild_queue)
+    {
+        return (false);
+    }
+
+    w->index_capacity = CHUNK_INDEX_INITIAL_CAPACITY;
+    w->index = (Chunk_index_slot *)memory_arena_alloc(arena, w->index_capacity * sizeof(Chunk_index_slot));
+    if (!w->index)
+    {
+        return (false);
+    }
+
+    for (int i = 0; i < w->index_capacity; i++)
+    {
+        w->index[i].key = 0;
+        w->index[i].chunk = 0;
+    }
+
+    return (true);
+}
+
+Chunk *world_find_chunk(World *w, int x, int y, int z)
+{
+    uint64_t key = chunk_index_key(x, y, z);
+    uint32_t mask = (uint32_t)w->index_capacity - 1;
+    uint32_t slot = chunk_index_hash(key) & mask;
+
+    Chunk *result = 0;
+    while (w->index[slot].chunk != 0)
+    {
+        if (w->index[slot].key == key)
+        {
+            result = w->index[slot].chunk;
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    return (result);
+}
+
+// NOTE(max): keeps load factor under 1/2. Old table stays in the arena, the total waste is bounded by the final table size.
+bool world_grow_index(World *w, Memory_arena *arena)
+{
+    int new_capacity = w->index_capacity * 2;
+    Chunk_index_slot *new_index = (Chunk_index_slot *)memory_arena_alloc(arena, new_capacity * sizeof(Chunk_index_slot));
+    if (!new_index)
+    {
+        return (false);
+    }
+
+    for (int i = 0; i < new_capacity; i++)
+    {
+        new_index[i].key = 0;
+        new_index[i].chunk = 0;
+    }
+
+    for (int i = 0; i < w->index_capacity; i++)
+    {
+        if (w->index[i].chunk)
+        {
+            chunk_index_insert(new_index, new_capacity, w->index[i].key, w->index[i].chunk);
+        }
+    }
+
+    w->index_capacity = new_capacity;
+    w->index = new_index;
+
+    return (true);
+}
+
+bool world_push_chunk_for_rebuild(World *w, Memory_arena *arena, Chunk *c)
+{
+    if (c->dirty)
+    {
+        return (true);
+    }
+
+    if (w->rebuild_queue_count == w->rebuild_queue_capacity)
+    {
+        int new_capacity = 2 * w->rebuild_queue_capacity;
+        Chunk_handle *new_queue = (Chunk_handle *)memory_arena_alloc(arena, new_capacity * sizeof(Chunk_handle));
+        if (!new_queue)
+        {
+            return (false);
+        }
+
+        memcpy(new_queue, w->rebuild_queue, w->rebuild_queue_count * sizeof(Chunk_handle));
+        w->rebuild_queue = new_queue;
+        w->rebuild_queue_capacity = new_capacity;
+    }
+
+    c->dirty = true;
+    w->rebuild_queue[w->rebuild_queue_count++] = chunk_handle(c);
+
+    return (true);
+}
+
+struct Rebuild_candidate
+{
+    bool out_of_view;
+    float distance_sq;
+    int queue_idx;
+};
+
+inline bool rebuild_candidate_before(const Rebuild_candidate &a, const Rebuild_candidate &b)
+{
+    if (a.out_of_view != b.out_of_view)
+    {
+        return (!a.out_of_view);
+    }
+    return (a.distance_sq < b.distance_sq);
+}
+
+// NOTE(max): takes up to max_chunks chunks out of the queue, the ones inside view first and nearest to cam_pos first.
+// Entries of removed chunks are dropped on the way. O(n) in the queue length, scratch is released before returning.
+// Pops nothing when scratch is full.
+int world_pop_chunks_for_rebuild(World *w, Frustum *view, Vec3f cam_pos, Memory_arena *scratch, Chunk **out, int max_chunks)
+{
+    int count = 0;
+    for (int i = 0; i < w->rebuild_queue_count; i++)
+    {
+        if (chunk_pool_get(&w->pool, w->rebuild_queue[i]))
+        {
+            w->rebuild_queue[count++] = w->rebuild_queue[i];
+        }
+    }
+    w->rebuild_queue_count = count;
+
+    if (count == 0 || max_chunks == 0)
+    {
+        return (0);
+    }
+
+    void *cursor = memory_arena_get_cursor(scratch);
+    Rebuild_candidate *candidates = (Rebuild_candidate *)memory_arena_alloc(scratch, count * sizeof(Rebuild_candidate));
+    if (!candidates)
+    {
+        return (0);
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        Chunk *c = chunk_pool_get(&w->pool, w->rebuild_queue[i]);
+        float dx = (c->x + 0.5f) * CHUNK_DIM - cam_pos.x;
+        float dy = (c->y + 0.5f) * CHUNK_DIM - cam_pos.y;
+        float dz = (c->z + 0.5f) * CHUNK_DIM - cam_pos.z;
+
+        candidates[i].out_of_view = !frustum_test_chunk(view, c->x, c->y, c->z);
+        candidates[i].distance_sq = dx * dx + dy * dy + dz * dz;
+        candidates[i].queue_idx = i;
+    }
+
+    int npopped = std::min(count, max_chunks);
+    if (npopped < count)
+    {
+        std::nth_element(candidates, candidates + npopped, candidates + count, rebuild_candidate_before);
+    }
+    std::sort(candidates, candidates + npopped, rebuild_candidate_before);
+
+    for (int i = 0; i < npopped; i++)
+    {
+        Chunk *c = chunk_pool_get(&w->pool, w->rebuild_queue[candidates[i].queue_idx]);
+        c->dirty = false;
+        out[i] = c;
+    }
+
+    int remaining = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (chunk_pool_get(&w->pool, w->rebuild_queue[i])->dirty)
+        {
+            w->rebuild_queue[remaining++] = w->rebuild_queue[i];
+        }
+    }
+    w->rebuild_queue_count = remaining;
+
+    memory_arena_set_cursor(scratch, cursor);
+    return (npopped);
+}
+
+// NOTE(max): faces of the neighbour chunks that touch a changed border block have to be remeshed too
+void world_push_neighbours_for_rebuild(World *w, Memory_arena *arena, Chunk *c, int block_x, int block_y, int block_z)
+{
+    for (int f = 0; f < FACE_COUNT; f++)
+    {
+        int x = block_x + Face_normals[f][0];
+        int y = block_y + Face_normals[f][1];
+        int z = block_z + Face_normals[f][2];
+        if ((x < 0 || x >= CHUNK_DIM || y < 0 || y >= CHUNK_DIM || z < 0 || z >= CHUNK_DIM) && c->neighbours[f])
+        {
+            world_push_chunk_for_rebuild(w, arena, c->neighbours[f]);
+        }
+    }
+}
+
+Chunk *world_add_chunk(World *world, Memory_arena *arena, int x, int y, int z)
+{
+    assert(world_find_chunk(world, x, y, z) == 0);
+
+    if (2 * (world->nchunks + 1) > world->index_capacity)
+    {
+        if (!world_grow_index(world, arena))
+        {
+            return (0);
+        }
+    }
+
+    Chunk *result = chunk_pool_alloc(&world->pool, arena);
+
+    if (result)
+    {
+        result->x = x;
+        result->y = y;
+        result->z = z;
+        result->next = world->next;
+        result->prev = 0;
+        for (int f = 0; f < FACE_COUNT; f++)
+        {
+            Chunk *n = world_find_chunk(world, x + Face_normals[f][0], y + Face_normals[f][1], z + Face_normals[f][2]);
+            result->neighbours[f] = n;
+            if (n)
+            {
+                n->neighbours[face_opposite(f)] = result;
+            }
+        }
+        result->nblocks = 0;
+        result->mesh_generation = 0;
+        result->uploaded_generation = 0;
+        result->face_links = FACE_LINKS_ALL;
+        result->cave_frame = 0;
+        result->dirty = false;
+        result->generated = false;
+        result->modified = false;
+
+        result->bits = 0;
+        result->palette_count = 1;
+        result->palette[0] = BLOCK_AIR;
+        result->indices = 0;
+        memset(&result->occupancy, 0, sizeof(result->occupancy));
+        result->light = 0;
+        result->light_fill = 0;
+
+        result->mesh.num_of_vs = 0;
+        result->mesh.format = VERTEX_FORMAT_FLOAT;
+        result->mesh.first_page = 0;
+        result->mesh.npages = 0;
+
+        if (world->next)
+        {
+            world->next->prev = result;
+        }
+        world->next = result;
+        world->nchunks++;
+        chunk_index_insert(world->index, world->index_capacity, chunk_index_key(x, y, z), result);
+    }
+
+    return (result);
+}
+
+// NOTE(max): linear probing removal by shifting the following entries back, no tombstones
+void chunk_index_remove(Chunk_index_slot *index, int capacity, uint64_t key)
+{
+    uint32_t mask = (uint32_t)capacity - 1;
+    uint32_t hole = chunk_index_hash(key) & mask;
+    while (index[hole].key != key)
+    {
+        assert(index[hole].chunk != 0);
+        hole = (hole + 1) & mask;
+    }
+
+    uint32_t slot = hole;
+    for (;;)
+    {
+        slot = (slot + 1) & mask;
+        if (index[slot].chunk == 0)
+        {
+            break;
+        }
+
+        // NOTE(max): an entry can move into the hole only if its home slot is not in (hole, slot]
+        uint32_t home = chunk_index_hash(index[slot].key) & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
+        {
+            index[hole] = index[slot];
+            hole = slot;
+        }
+    }
+
+    index[hole].key = 0;
+    index[hole].chunk = 0;
+}
+
+// NOTE(max): the chunk must not own GL objects anymore, handles to it go stale
+void world_remove_chunk(World *world, Chunk *c)
+{
+    assert(world_find_chunk(world, c->x, c->y, c->z) == c);
+    assert(c->mesh.npages == 0);
+
+    chunk_index_remove(world->index, world->index_capacity, chunk_index_key(c->x, c->y, c->z));
+    for (int f = 0; f < FACE_COUNT; f++)
+    {
+        if (c->neighbours[f])
+        {
+            assert(c->neighbours[f]->neighbours[face_opposite(f)] == c);
+            c->neighbours[f]->neighbours[face_opposite(f)] = 0;
+            c->neighbours[f] = 0;
+        }
+    }
+
+    if (c->prev)
+    {
+        c->prev->next = c->next;
+    }
+    else
+    {
+        world->next = c->next;
+    }
+    if (c->next)
+    {
+        c->next->prev = c->prev;
+    }
+
+    if (c->indices)
+    {
+        block_storage_free(&world->block_storage, c->indices, c->bits);
+        c->indices = 0;
+    }
+    chunk_fill_light(&world->block_storage, c, 0);
+
+    world->nchunks--;
+    chunk_pool_free(&world->pool, c);
+}
+
+enum Mesher_mode
+{
+    MESHER_VOLUME,  // all six faces of every range
+    MESHER_SURFACE, // only the parts of range faces that touch air
+    MESHER_GREEDY,  // per slice greedy quads built from row bitmasks, gen_ranges_3d is not used
+};
+
+#define DEFAULT_MESHER_MODE MESHER_GREEDY
+
+// NOTE(max): fixed pool of worker threads. Every thread of the pool (the thread that called job_system_init is 0)
+// has its own Chase-Lev deque: the owner pushes and pops at the bottom, idle threads steal the oldest job from the
+// top of the others. A job is a function with a range. Its counter, if any, is incremented on submit and
+// decremented when the job has run. Jobs can be held back until a counter reaches zero, and waiting on a counter
+// runs other jobs in the meantime instead of blocking.
+#define JOB_MAX_THREADS 32
+#define JOB_QUEUE_SIZE 1024
+#define JOB_COUNTER_MAX_WAITING 8
+// NOTE(max): idle workers yield this many times before they go to sleep
+#define JOB_SPIN_COUNT 64
+
+static_assert((JOB_QUEUE_SIZE & (JOB_QUEUE_SIZE - 1)) == 0, "JOB_QUEUE_SIZE has to be a power of two");
+
+typedef void Job_proc(void *data, int begin, int end);
+
+struct Job_counter;
+
+struct Job
+{
+    Job_proc *proc;
+    void *data;
+    int begin;
+    int end;
+    Job_counter *counter;
+};
+
+struct Job_counter
+{
+    std::atomic<int> remaining;
+
+    // NOTE(max): jobs from job_submit_after, whoever finishes the last job of the counter pushes them
+    std::mutex mutex;
+    int nwaiting;
+    Job waiting[JOB_COUNTER_MAX_WAITING];
+};
+
+struct Job_queue
+{
+    std::atomic<int64_t> top;
+    uint8_t pad0[64];
+    std::atomic<int64_t> bottom;
+    uint8_t pad1[64];
+    Job jobs[JOB_QUEUE_SIZE];
+};
+
+struct Job_system
+{
+    // NOTE(max): including the main thread
+    int nthreads;
+    Job_queue queues[JOB_MAX_THREADS];
+    std::thread workers[JOB_MAX_THREADS];
+
+    // NOTE(max): jobs sitting in any of the queues, idle workers sleep while it is zero
+    std::atomic<int> queued;
+    std::atomic<int> sleeping;
+    std::atomic<bool> quit;
+    std::mutex mutex;
+    std::condition_variable has_work;
+
+    std::atomic<uint64_t> executed;
+    std::atomic<uint64_t> stolen;
+};
+
+// NOTE(max): index of the calling thread in the pool, -1 for threads outside of it
+thread_local int Job_thread_index = -1;
+
+void job_counter_init(Job_counter *counter)
+{
+    counter->remaining.store(0);
+    counter->nwaiting = 0;
+}
+
+bool job_queue_push(Job_queue *q, const Job &job)
+{
+    int64_t b = q->bottom.load(std::memory_order_relaxed);
+    int64_t t = q->top.load(std::memory_order_acquire);
+    if (b - t >= JOB_QUEUE_SIZE)
+    {
+        return (false);
+    }
+
+    q->jobs[b & (JOB_QUEUE_SIZE - 1)] = job;
+    std::atomic_thread_fence(std::memory_order_release);
+    q->bottom.store(b + 1, std::memory_order_relaxed);
+    return (true);
+}
+
+// NOTE(max): owner only
+bool job_queue_pop(Job_queue *q, Job *out)
+{
+    int64_t b = q->bottom.load(std::memory_order_relaxed) - 1;
+    q->bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = q->top.load(std::memory_order_relaxed);
+
+    bool result = false;
+    if (t <= b)
+    {
+        *out = q->jobs[b & (JOB_QUEUE_SIZE - 1)];
+        result = true;
+        if (t == b)
+        {
+            // NOTE(max): last job, race the thieves for it
+            result = q->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            q->bottom.store(b + 1, std::memory_order_relaxed);
+        }
+    }
+    else
+    {
+        q->bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return (result);
+}
+
+bool job_queue_steal(Job_queue *q, Job *out)
+{
+    int64_t t = q->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = q->bottom.load(std::memory_order_acquire);
+    if (t >= b)
+    {
+        return (false);
+    }
+
+    Job job = q->jobs[t & (JOB_QUEUE_SIZE - 1)];
+    if (!q->top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+    {
+        return (false);
+    }
+    *out = job;
+    return (true);
+}
+
+bool job_try_take(Job_system *sys, int thread, Job *out)
+{
+    bool result = job_queue_pop(&sys->queues[thread], out);
+    for (int i = 1; !result && (i < sys->nthreads); i++)
+    {
+        result = job_queue_steal(&sys->queues[(thread + i) % sys->nthreads], out);
+        if (result)
+        {
+            sys->stolen.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    if (result)
+    {
+        sys->queued.fetch_sub(1);
+    }
+    return (result);
+}
+
+void job_run(Job_system *sys, Job *job);
+
+// NOTE(max): does not touch the counter of the job, a full queue runs the job right away
+void job_push(Job_system *sys, const Job &job)
+{
+    int thread = Job_thread_index;
+    assert((thread >= 0) && (thread < sys->nthreads));
+
+    if (!job_queue_push(&sys->queues[thread], job))
+    {
+        Job inline_job = job;
+        job_run(sys, &inline_job);
+        return;
+    }
+
+    sys->queued.fetch_add(1);
+    if (sys->sleeping.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(sys->mutex);
+        sys->has_work.notify_one();
+    }
+}
+
+void job_counter_decrement(Job_system *sys, Job_counter *counter)
+{
+    // NOTE(max): the decrement happens under the lock, so a waiter that saw zero and then took the lock
+    // knows nobody touches the counter anymore
+    int nready = 0;
+    Job ready[JOB_COUNTER_MAX_WAITING];
+    {
+        std::lock_guard<std::mutex> lock(counter->mutex);
+        if (counter->remaining.fetch_sub(1) == 1)
+        {
+            nready = counter->nwaiting;
+            for (int i = 0; i < nready; i++)
+            {
+                ready[i] = counter->waiting[i];
+            }
+            counter->nwaiting = 0;
+        }
+    }
+
+    for (int i = 0; i < nready; i++)
+    {
+        job_push(sys, ready[i]);
+    }
+}
+
+void job_run(Job_system *sys, Job *job)
+{
+    job->proc(job->data, job->begin, job->end);
+    sys->executed.fetch_add(1, std::memory_order_relaxed);
+    if (job->counter)
+    {
+        job_counter_decrement(sys, job->counter);
+    }
+}
+
+void job_submit(Job_system *sys, Job_proc *proc, void *data, int begin, int end, Job_counter *counter)
+{
+    Job job = {proc, data, begin, end, counter};
+    if (counter)
+    {
+        counter->remaining.fetch_add(1);
+    }
+    job_push(sys, job);
+}
+
+// NOTE(max): the job is pushed once every job of after has run, right away if there are none left. At most
+// JOB_COUNTER_MAX_WAITING jobs wait on one counter, past that nothing is submitted and the result is false.
+bool job_submit_after(Job_system *sys, Job_counter *after, Job_proc *proc, void *data, int begin, int end,
+                      Job_counter *counter)
+{
+    Job job = {proc, data, begin, end, counter};
+    {
+        std::lock_guard<std::mutex> lock(after->mutex);
+        if (after->remaining.load() > 0)
+        {
+            if (after->nwaiting == JOB_COUNTER_MAX_WAITING)
+            {
+                return (false);
+            }
+            if (counter)
+            {
+                counter->remaining.fetch_add(1);
+            }
+            after->waiting[after->nwaiting++] = job;
+            return (true);
+        }
+    }
+
+    if (counter)
+    {
+        counter->remaining.fetch_add(1);
+    }
+    job_push(sys, job);
+    return (true);
+}
+
+// NOTE(max): proc gets [begin, end) ranges of at most grain items
+void parallel_for(Job_system *sys, Job_counter *counter, Job_proc *proc, void *data, int count, int grain)
+{
+    assert(grain > 0);
+    for (int begin = 0; begin < count; begin += grain)
+    {
+        job_submit(sys, proc, data, begin, std::min(begin + grain, count), counter);
+    }
+}
+
+// NOTE(max): runs jobs, anyone's, until every job of the counter is done
+void job_wait(Job_system *sys, Job_counter *counter)
+{
+    int thread = Job_thread_index;
+    assert((thread >= 0) && (thread < sys->nthreads));
+
+    while (counter->remaining.load() > 0)
+    {
+        Job job;
+        if (job_try_take(sys, thread, &job))
+        {
+            job_run(sys, &job);
+        }
+        else
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(counter->mutex);
+}
+
+void job_worker_proc(Job_system *sys, int thread)
+{
+    Job_thread_index = thread;
+
+    int spins = 0;
+    while (!sys->quit.load())
+    {
+        Job job;
+        if (job_try_take(sys, thread, &job))
+        {
+            job_run(sys, &job);
+            spins = 0;
+        }
+        else if (++spins < JOB_SPIN_COUNT)
+        {
+            std::this_thread::yield();
+        }
+        else
+        {
+            std::unique_lock<std::mutex> lock(sys->mutex);
+            sys->sleeping.fetch_add(1);
+            sys->has_work.wait(lock, [sys] { return (sys->quit.load() || (sys->queued.load() > 0)); });
+            sys->sleeping.fetch_sub(1);
+            spins = 0;
+        }
+    }
+}
+
+// NOTE(max): the calling thread becomes thread 0 of the pool, nthreads includes it
+void job_system_init(Job_system *sys, int nthreads)
+{
+    sys->nthreads = std::min(std::max(nthreads, 1), JOB_MAX_THREADS);
+    for (int i = 0; i < sys->nthreads; i++)
+    {
+        sys->queues[i].top.store(0);
+        sys->queues[i].bottom.store(0);
+    }
+    sys->queued.store(0);
+    sys->sleeping.store(0);
+    sys->quit.store(false);
+    sys->executed.store(0);
+    sys->stolen.store(0);
+
+    Job_thread_index = 0;
+    for (int i = 1; i < sys->nthreads; i++)
+    {
+        sys->workers[i] = std::thread(job_worker_proc, sys, i);
+    }
+}
+
+// NOTE(max): jobs that did not start yet are dropped
+void job_system_shutdown(Job_system *sys)
+{
+    {
+        std::lock_guard<std::mutex> lock(sys->mutex);
+        sys->quit.store(true);
+    }
+    sys->has_work.notify_all();
+
+    for (int i = 1; i < sys->nthreads; i++)
+    {
+        sys->workers[i].join();
+    }
+    sys->nthreads = 1;
+}
+
+// NOTE(max): chunks are meshed on the job system from snapshots of their blocks, only the GL upload happens on the
+// main thread. A job slot is owned by the main thread while it is free or done, and by the job system while it is
+// pending.
+#define MESH_JOB_COUNT 16
+#define MESH_JOB_MEMORY_SIZE MEMORY_MB(8)
+
+struct Mesh_job;
+
+struct Mesh_pool
+{
+    Job_system *job_system;
+    Mesh_job *jobs;
+
+    // main thread only
+    int nfree;
+    int free_jobs[MESH_JOB_COUNT];
+
+    // NOTE(max): finished jobs, in the order they finished
+    std::mutex mutex;
+    int ndone;
+    int done[MESH_JOB_COUNT];
+};
+
+enum Render_pass
+{
+    RENDER_PASS_SHADOW_1,
+    RENDER_PASS_SHADOW_2,
+    RENDER_PASS_SHADOW_3,
+    RENDER_PASS_SHADOW_4,
+    RENDER_PASS_CAMERA,
+
+    RENDER_PASS_COUNT
+};
+
+const char *Render_pass_names[RENDER_PASS_COUNT] =
+{
+    "shadow 1", "shadow 2", "shadow 3", "shadow 4", "camera"
+};
+
+// NOTE(max): chunk counts of the last frame, printed on enter. A shadow pass that reused its cached map
+// keeps the counts of the frame it was rendered in. The camera pass also drops chunks in view that
+// cave_cull_chunks could not reach, they are counted in occluded.
+struct Render_stats
+{
+    int drawn[RENDER_PASS_COUNT];
+    int culled[RENDER_PASS_COUNT];
+    bool cached[RENDER_PASS_COUNT];
+    uint64_t shadow_updates;
+    int occluded;
+    int cave_reachable;
+    int loaded;
+    // NOTE(max): glMultiDrawArrays calls of all passes
+    int draw_calls;
+};
+
+// NOTE(max): chunk meshes of one vertex format share one vertex buffer. A mesh takes a slot of whole pages, found
+// first fit in the free ranges (sorted by page, neighbours are merged when a slot is freed). When no free range is
+// big enough the live slots are copied to the front of a new buffer, which is twice as big if they still would not
+// fit. The vertex shaders find the chunk of a vertex by its page: gl_VertexID / GPU_PAGE_VERTICES indexes a buffer
+// texture with the block offset of the chunk that owns the page, so a pass draws all its chunks of one format with
+// a single glMultiDrawArrays.
+#define GPU_PAGE_VERTICES 256
+#define GPU_BUFFER_INITIAL_PAGES 1024
+#define GPU_BUFFER_MAX_PAGES (1 << 16)
+// NOTE(max): texture unit of the page offsets, the shadow maps take 2..5
+#define GPU_PAGE_OFFSETS_UNIT 6
+
+struct Gpu_range
+{
+    uint32_t first;
+    uint32_t count;
+};
+
+struct Gpu_buffer_stats
+{
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t grows;
+    uint64_t compactions;
+    uint64_t pages_moved;
+    uint64_t failed;
+};
+
+struct Gpu_buffer
+{
+    Vertex_format format;
+    uint32_t vertex_size;
+    GLuint vao;
+    GLuint vbo;
+    GLuint offsets_buffer;
+    GLuint offsets_texture;
+
+    uint32_t npages;
+    uint32_t used_pages;
+    int nfree;
+    Gpu_range *free_ranges;
+    // NOTE(max): per page, the chunk whose slot it is in (0 if free) and the block offset of that chunk as an RGBA32I
+    // texel, a copy of what is in offsets_buffer
+    Chunk **owners;
+    int32_t *offsets;
+
+    Gpu_buffer_stats stats;
+};
+
+#define SHADOW_CASCADE_COUNT 4
+#define SHADOW_MAP_SIZE 2048
+// NOTE(max): a cascade is re-rendered when the sun turned by more than this since its last update...
+#define SHADOW_LIGHT_THRESHOLD_DEG 0.5f
+// NOTE(max): ...when the camera left the snapped cell the cascade was centered on, a cell is this many texels...
+#define SHADOW_SNAP_TEXELS 32
+// NOTE(max): ...or when a chunk inside it was remeshed. Cascades from this one on wait for their turn,
+// at most one of them is updated per frame.
+#define SHADOW_FIRST_STAGGERED_CASCADE 2
+
+float Shadow_cascade_extents[SHADOW_CASCADE_COUNT] = { 10.0f, 20.0f, 40.0f, 80.0f };
+
+struct Shadow_cascade
+{
+    bool valid;
+    bool dirty;
+    glm::vec3 light_dir;
+    glm::vec3 center;
+    glm::mat4 projection_view;
+    Frustum frustum;
+};
+
+// NOTE(max): main thread time spent on rebuilds (uploads and job submission) per frame
+#define DEFAULT_REBUILD_BUDGET_US 2000.0
+
+struct Rebuild_stats
+{
+    uint64_t chunks_meshed;
+    uint64_t chunks_uploaded;
+    double mesh_us_total;
+    double upload_us_total;
+
+    // NOTE(max): last frame
+    int uploads;
+    int submits;
+    double frame_us;
+
+    // NOTE(max): from the moment something became dirty until the queue is empty and no job is in flight
+    bool cleaning;
+    double cleaning_since;
+    double last_time_to_clean_ms;
+};
+
+// NOTE(max): edited chunks are saved to region files of REGION_DIM^3 chunks, REGION_DIM x REGION_DIM columns that
+// are REGION_DIM chunks high since the world has no height limit. A file is a header and a table with the offset and
+// size of every chunk, followed by the compressed chunks. Changed chunks are appended and their table entry is
+// overwritten, the old copy is garbage until the file is compacted. Reads go through a mapping of the file.
+#define REGION_DIM_LOG2 5
+#define REGION_DIM (1 << REGION_DIM_LOG2)
+#define REGION_CHUNKS (REGION_DIM * REGION_DIM * REGION_DIM)
+#define REGION_MAGIC 0x324E4752u // "RGN2"
+// NOTE(max): before BLOCK_LAMP, air was 4. These files are upgraded in place when they are opened.
+#define REGION_MAGIC_V1 0x314E4752u // "RGN1"
+#define REGION_V1_AIR 4
+#define REGION_CACHE_SIZE 16
+// NOTE(max): a file is compacted once it has more garbage than live chunks and at least this much of it
+#define REGION_COMPACT_MIN_GARBAGE MEMORY_MB(1)
+#define REGION_PATH_MAX 256
+// NOTE(max): longest world directory, "/r.-32768.-32768.-32768.rgn.tmp" and the terminator take the rest
+#define REGION_DIR_MAX (REGION_PATH_MAX - 32)
+// NOTE(max): runs of (length - 1, type) pairs after a uint16_t pair count, the worst case is one run per block
+#define REGION_MAX_PAYLOAD_SIZE (2 + 2 * BLOCKS_IN_CHUNK)
+
+struct Region_entry
+{
+    uint32_t offset; // 0 if the chunk is not in the file
+    uint32_t size;
+};
+
+struct Region_header
+{
+    uint32_t magic;
+    uint32_t dim;
+    Region_entry table[REGION_CHUNKS];
+};
+
+struct Region
+{
+    bool used;
+    // NOTE(max): false if there is no file yet, it is created on the first write
+    bool exists;
+    int x;
+    int y;
+    int z;
+    uint64_t last_used;
+
+    FILE *file;
+    uint64_t file_size;
+    uint8_t *map;
+    uint64_t mapped_size;
+
+    uint64_t live_bytes;
+    uint64_t garbage_bytes;
+    Region_header *header;
+};
+
+struct Region_stats
+{
+    uint64_t chunks_read;
+    uint64_t chunks_written;
+    uint64_t bytes_written;
+    uint64_t compactions;
+};
+
+struct Region_cache
+{
+    char dir[REGION_PATH_MAX];
+    uint64_t use_counter;
+    Region regions[REGION_CACHE_SIZE];
+    Region_stats stats;
+};
+
+inline int region_coord(int chunk)
+{
+    return (chunk >> REGION_DIM_LOG2);
+}
+
+inline int region_chunk_index(int chunk_x, int chunk_y, int chunk_z)
+{
+    int x = chunk_x & (REGION_DIM - 1);
+    int y = chunk_y & (REGION_DIM - 1);
+    int z = chunk_z & (REGION_DIM - 1);
+    return (REGION_DIM * REGION_DIM * y + REGION_DIM * z + x);
+}
+
+// NOTE(max): false if the path does not fit, region_cache_init keeps dir short enough that it always does
+bool region_path(Region_cache *cache, int x, int y, int z, const char *suffix, char *out)
+{
+    int length = snprintf(out, REGION_PATH_MAX, "%s/r.%d.%d.%d.rgn%s", cache->dir, x, y, z, suffix);
+    return ((length >= 0) && (length < REGION_PATH_MAX));
+}
+
+// NOTE(max): runs of equal blocks in storage order, the terrain is layered in y so they are long
+int region_compress_blocks(const uint8_t *blocks, uint8_t *out)
+{
+    int npairs = 0;
+    uint8_t *pairs = out + 2;
+    for (int i = 0; i < BLOCKS_IN_CHUNK;)
+    {
+        uint8_t type = blocks[i];
+        int run = 1;
+        while ((i + run < BLOCKS_IN_CHUNK) && (run < 256) && (blocks[i + run] == type))
+        {
+            run++;
+        }
+        pairs[2 * npairs] = (uint8_t)(run - 1);
+        pairs[2 * npairs + 1] = type;
+        npairs++;
+        i += run;
+    }
+    out[0] = (uint8_t)(npairs & 0xFF);
+    out[1] = (uint8_t)(npairs >> 8);
+    return (2 + 2 * npairs);
+}
+
+bool region_decompress_blocks(const uint8_t *in, uint32_t size, uint8_t *blocks)
+{
+    if (size < 2)
+    {
+        return (false);
+    }
+
+    int npairs = in[0] | (in[1] << 8);
+    if ((uint32_t)(2 + 2 * npairs) != size)
+    {
+        return (false);
+    }
+
+    int n = 0;
+    const uint8_t *pairs = in + 2;
+    for (int i = 0; i < npairs; i++)
+    {
+        int run = pairs[2 * i] + 1;
+        uint8_t type = pairs[2 * i + 1];
+        if ((n + run > BLOCKS_IN_CHUNK) || ((type >= BLOCK_TYPE_COUNT) && (type != BLOCK_AIR)))
+        {
+            return (false);
+        }
+        memset(blocks + n, type, run);
+        n += run;
+    }
+    return (n == BLOCKS_IN_CHUNK);
+}
+
+bool region_cache_init(Region_cache *cache, Memory_arena *arena, const char *dir)
+{
+    if (strlen(dir) > REGION_DIR_MAX)
+    {
+        return (false);
+    }
+    snprintf(cache->dir, REGION_PATH_MAX, "%s", dir);
+    cache->use_counter = 0;
+    cache->stats = {};
+    for (int i = 0; i < REGION_CACHE_SIZE; i++)
+    {
+        Region *r = &cache->regions[i];
+        r->used = false;
+        r->file = 0;
+        r->map = 0;
+        r->header = (Region_header *)memory_arena_alloc(arena, sizeof(Region_header));
+        if (!r->header)
+        {
+            return (false);
+        }
+    }
+    return (true);
+}
+
+void region_unmap(Region *r)
+{
+    if (r->map)
+    {
+        platform_unmap_file(r->map, r->mapped_size);
+        r->map = 0;
+        r->mapped_size = 0;
+    }
+}
+
+bool region_map(Region_cache *cache, Region *r)
+{
+    char path[REGION_PATH_MAX];
+    region_unmap(r);
+    if (!region_path(cache, r->x, r->y, r->z, "", path))
+    {
+        return (false);
+    }
+    r->map = (uint8_t *)platform_map_file(path, &r->mapped_size);
+    return (r->map != 0);
+}
+
+void region_close(Region *r)
+{
+    region_unmap(r);
+    if (r->file)
+    {
+        fclose(r->file);
+        r->file = 0;
+    }
+    r->used = false;
+}
+
+// NOTE(max): the payloads keep their size, only the types of the runs change
+bool region_upgrade_v1(Region_cache *cache, Region *r)
+{
+    char path[REGION_PATH_MAX];
+    FILE *file = region_path(cache, r->x, r->y, r->z, "", path) ? fopen(path, "r+b") : 0;
+    if (!file)
+    {
+        return (false);
+    }
+
+    const Region_header *header = (const Region_header *)r->map;
+    bool ok = true;
+    uint8_t payload[REGION_MAX_PAYLOAD_SIZE];
+    for (int i = 0; ok && (i < REGION_CHUNKS); i++)
+    {
+        Region_entry e = header->table[i];
+        if (!e.offset || (e.size < 2) || (e.size > REGION_MAX_PAYLOAD_SIZE) || ((uint64_t)e.offset + e.size > r->mapped_size))
+        {
+            continue;
+        }
+
+        memcpy(payload, r->map + e.offset, e.size);
+        for (uint32_t type = 3; type < e.size; type += 2)
+        {
+            if (payload[type] == REGION_V1_AIR)
+            {
+                payload[type] = BLOCK_AIR;
+            }
+        }
+        ok = (fseek(file, (long)e.offset, SEEK_SET) == 0) && (fwrite(payload, 1, e.size, file) == e.size);
+    }
+
+    uint32_t magic = REGION_MAGIC;
+    ok = ok && (fseek(file, 0, SEEK_SET) == 0) && (fwrite(&magic, sizeof(magic), 1, file) == 1);
+    ok = (fclose(file) == 0) && ok;
+
+    return (ok && region_map(cache, r));
+}
+
+// NOTE(max): reads the table of an existing file, a missing or broken file counts as an empty region
+void region_open(Region_cache *cache, Region *r, int x, int y, int z)
+{
+    r->used = true;
+    r->exists = false;
+    r->x = x;
+    r->y = y;
+    r->z = z;
+    r->file = 0;
+    r->file_size = 0;
+    r->map = 0;
+    r->mapped_size = 0;
+    r->live_bytes = 0;
+    r->garbage_bytes = 0;
+    memset(r->header, 0, sizeof(Region_header));
+    r->header->magic = REGION_MAGIC;
+    r->header->dim = REGION_DIM;
+
+    if (!region_map(cache, r))
+    {
+        return;
+    }
+
+    Region_header *header = (Region_header *)r->map;
+    if ((r->mapped_size >= sizeof(Region_header)) && (header->magic == REGION_MAGIC_V1) && (header->dim == REGION_DIM))
+    {
+        if (!region_upgrade_v1(cache, r))
+        {
+            printf("region: upgrading region file %d %d %d failed\n", x, y, z);
+            region_unmap(r);
+            return;
+        }
+        header = (Region_header *)r->map;
+    }
+    if ((r->mapped_size < sizeof(Region_header)) || (header->magic != REGION_MAGIC) || (header->dim != REGION_DIM))
+    {
+        printf("region: ignoring broken region file %d %d %d\n", x, y, z);
+        region_unmap(r);
+        return;
+    }
+
+    memcpy(r->header, header, sizeof(Region_header));
+    r->exists = true;
+    r->file_size = r->mapped_size;
+    uint64_t payload_bytes = r->file_size - sizeof(Region_header);
+    for (int i = 0; i < REGION_CHUNKS; i++)
+    {
+        Region_entry e = r->header->table[i];
+        if (e.offset && ((uint64_t)e.offset + e.size > r->file_size))
+        {
+            r->header->table[i].offset = 0;
+            r->header->table[i].size = 0;
+            continue;
+        }
+        r->live_bytes += e.size;
+    }
+    r->garbage_bytes = payload_bytes - std::min(payload_bytes, r->live_bytes);
+}
+
+Region *region_cache_get(Region_cache *cache, int x, int y, int z)
+{
+    Region *lru = &cache->regions[0];
+    for (int i = 0; i < REGION_CACHE_SIZE; i++)
+    {
+        Region *r = &cache->regions[i];
+        if (r->used && (r->x == x) && (r->y == y) && (r->z == z))
+        {
+            r->last_used = ++cache->use_counter;
+            return (r);
+        }
+        if (!r->used || (lru->used && (r->last_used < lru->last_used)))
+        {
+            lru = r;
+        }
+    }
+
+    if (lru->used)
+    {
+        region_close(lru);
+    }
+    region_open(cache, lru, x, y, z);
+    lru->last_used = ++cache->use_counter;
+    return (lru);
+}
+
+bool region_has_chunk(Region_cache *cache, int chunk_x, int chunk_y, int chunk_z)
+{
+    Region *r = region_cache_get(cache, region_coord(chunk_x), region_coord(chunk_y), region_coord(chunk_z));
+    return (r->header->table[region_chunk_index(chunk_x, chunk_y, chunk_z)].offset != 0);
+}
+
+// NOTE(max): false if the chunk was never saved
+bool region_read_chunk(Region_cache *cache, int chunk_x, int chunk_y, int chunk_z, uint8_t *blocks)
+{
+    Region *r = region_cache_get(cache, region_coord(chunk_x), region_coord(chunk_y), region_coord(chunk_z));
+    Region_entry e = r->header->table[region_chunk_index(chunk_x, chunk_y, chunk_z)];
+    if (e.offset == 0)
+    {
+        return (false);
+    }
+
+    // NOTE(max): the chunk was appended after the file was mapped
+    if ((uint64_t)e.offset + e.size > r->mapped_size)
+    {
+        if (r->file)
+        {
+            fflush(r->file);
+        }
+        if (!region_map(cache, r) || ((uint64_t)e.offset + e.size > r->mapped_size))
+        {
+            return (false);
+        }
+    }
+
+    if (!region_decompress_blocks(r->map + e.offset, e.size, blocks))
+    {
+        printf("region: broken chunk %d %d %d\n", chunk_x, chunk_y, chunk_z);
+        return (false);
+    }
+    cache->stats.chunks_read++;
+    return (true);
+}
+
+// NOTE(max): writes the live chunks to a new file that replaces the old one
+bool region_compact(Region_cache *cache, Region *r)
+{
+    if (r->file)
+    {
+        fflush(r->file);
+    }
+    if (!region_map(cache, r))
+    {
+        return (false);
+    }
+
+    char path[REGION_PATH_MAX];
+    char tmp_path[REGION_PATH_MAX];
+    if (!region_path(cache, r->x, r->y, r->z, "", path) || !region_path(cache, r->x, r->y, r->z, ".tmp", tmp_path))
+    {
+        return (false);
+    }
+    FILE *out = fopen(tmp_path, "wb");
+    if (!out)
+    {
+        return (false);
+    }
+
+    bool ok = fwrite(r->header, sizeof(Region_header), 1, out) == 1;
+    uint64_t offset = sizeof(Region_header);
+    for (int i = 0; ok && (i < REGION_CHUNKS); i++)
+    {
+        Region_entry *e = &r->header->table[i];
+        if (e->offset)
+        {
+            ok = fwrite(r->map + e->offset, 1, e->size, out) == e->size;
+            e->offset = (uint32_t)offset;
+            offset += e->size;
+        }
+    }
+    ok = ok && (fseek(out, 0, SEEK_SET) == 0) && (fwrite(r->header, sizeof(Region_header), 1, out) == 1);
+    ok = (fclose(out) == 0) && ok;
+
+    // NOTE(max): windows can not replace a file that is open or mapped
+    region_unmap(r);
+    if (r->file)
+    {
+        fclose(r->file);
+        r->file = 0;
+    }
+
+    ok = ok && platform_replace_file(tmp_path, path);
+    if (!ok)
+    {
+        remove(tmp_path);
+        printf("region: compacting %d %d %d failed\n", r->x, r->y, r->z);
+    }
+
+    // NOTE(max): the table in memory is only right if the new file made it, read it back either way
+    int x = r->x;
+    int y = r->y;
+    int z = r->z;
+    region_open(cache, r, x, y, z);
+    cache->stats.compactions += ok;
+    return (ok);
+}
+
+bool region_write_chunk(Region_cache *cache, int chunk_x, int chunk_y, int chunk_z, const uint8_t *blocks)
+{
+    Region *r = region_cache_get(cache, region_coord(chunk_x), region_coord(chunk_y), region_coord(chunk_z));
+    if (!r->file)
+    {
+        char path[REGION_PATH_MAX];
+        if (!region_path(cache, r->x, r->y, r->z, "", path))
+        {
+            return (false);
+        }
+        if (r->exists)
+        {
+            r->file = fopen(path, "r+b");
+        }
+        else
+        {
+            platform_make_directory(cache->dir);
+            r->file = fopen(path, "w+b");
+            if (r->file && (fwrite(r->header, sizeof(Region_header), 1, r->file) == 1))
+            {
+                r->exists = true;
+                r->file_size = sizeof(Region_header);
+            }
+        }
+        if (!r->file || !r->exists)
+        {
+            printf("region: can not write %s\n", path);
+            return (false);
+        }
+    }
+
+    uint8_t payload[REGION_MAX_PAYLOAD_SIZE];
+    uint32_t size = (uint32_t)region_compress_blocks(blocks, payload);
+    // NOTE(max): offsets go through fseek, which takes a long
+    if (r->file_size + size > 0x7FFFFFFFull)
+    {
+        return (false);
+    }
+
+    int idx = region_chunk_index(chunk_x, chunk_y, chunk_z);
+    Region_entry e = {(uint32_t)r->file_size, size};
+    bool ok = (fseek(r->file, (long)r->file_size, SEEK_SET) == 0) && (fwrite(payload, 1, size, r->file) == size);
+    ok = ok && (fseek(r->file, (long)(offsetof(Region_header, table) + idx * sizeof(Region_entry)), SEEK_SET) == 0) &&
+        (fwrite(&e, sizeof(e), 1, r->file) == 1);
+    if (!ok)
+    {
+        printf("region: writing chunk %d %d %d failed\n", chunk_x, chunk_y, chunk_z);
+        return (false);
+    }
+
+    Region_entry old = r->header->table[idx];
+    if (old.offset)
+    {
+        r->live_bytes -= old.size;
+        r->garbage_bytes += old.size;
+    }
+    r->header->table[idx] = e;
+    r->live_bytes += size;
+    r->file_size += size;
+    cache->stats.chunks_written++;
+    cache->stats.bytes_written += size;
+
+    if ((r->garbage_bytes >= REGION_COMPACT_MIN_GARBAGE) && (r->garbage_bytes > r->live_bytes))
+    {
+        region_compact(cache, r);
+    }
+    return (true);
+}
+
+// NOTE(max): forgets open files and mappings without closing them, they belong to another run
+void region_cache_reset(Region_cache *cache)
+{
+    for (int i = 0; i < REGION_CACHE_SIZE; i++)
+    {
+        cache->regions[i].used = false;
+        cache->regions[i].file = 0;
+        cache->regions[i].map = 0;
+        cache->regions[i].mapped_size = 0;
+    }
+}
+
+void region_cache_close_all(Region_cache *cache)
+{
+    for (int i = 0; i < REGION_CACHE_SIZE; i++)
+    {
+        if (cache->regions[i].used)
+        {
+            region_close(&cache->regions[i]);
+        }
+    }
+}
+
+// NOTE(max): chunks within stream_radius (Chebyshev distance in xz, STREAM_RADIUS_Y in y) of the camera chunk are
+// loaded, nearest first. They are unloaded only once they are STREAM_UNLOAD_MARGIN further out than that,
+// so walking back and forth over a chunk border does not reload anything.
+#define DEFAULT_STREAM_RADIUS 8
+#define STREAM_MAX_RADIUS 32
+#define STREAM_RADIUS_Y 2
+#define STREAM_UNLOAD_MARGIN 2
+// NOTE(max): generation never takes more than half of the mesh jobs, meshing keeps going while the world loads
+#define STREAM_MAX_GENERATE_JOBS (MESH_JOB_COUNT / 2)
+#define STREAM_MAX_UNLOADS_PER_FRAME 64
+#define STREAM_MAX_DISK_LOADS_PER_FRAME 64
+
+struct Stream_offset
+{
+    int8_t x;
+    int8_t y;
+    int8_t z;
+};
+
+struct Stream_stats
+{
+    uint64_t loaded_total;
+    uint64_t unloaded_total;
+    uint64_t loaded_from_disk;
+    double generate_us_total;
+
+    // NOTE(max): last frame
+    int loaded;
+    int unloaded;
+};
+
+struct Streamer
+{
+    int radius;
+
+    // NOTE(max): every offset within STREAM_MAX_RADIUS, sorted by distance
+    int noffsets;
+    Stream_offset *offsets;
+
+    int generating;
+
+    // NOTE(max): nothing was missing within radius of this camera chunk last time we looked
+    bool complete;
+    int complete_x;
+    int complete_y;
+    int complete_z;
+
+    Stream_stats stats;
+};
+
+// NOTE(max): nodes of one light update, the queues are ring buffers that are drained before the update returns,
+// so the chunk pointers never outlive the chunks
+#define LIGHT_QUEUE_SIZE (1 << 16)
+#define LIGHT_CHANNEL_BLOCK 0
+#define LIGHT_CHANNEL_SKY 1
+
+struct Light_node
+{
+    Chunk *c;
+    uint16_t idx;
+    // NOTE(max): removal nodes only, light the block had in channel before it was cleared
+    uint8_t value;
+    uint8_t channel;
+};
+
+struct Light_queue
+{
+    Light_node *nodes;
+    uint32_t head;
+    uint32_t count;
+};
+
+struct Light_stats
+{
+    uint64_t chunks_lit;
+    uint64_t edits;
+    uint64_t nodes_added;
+    uint64_t nodes_removed;
+    // NOTE(max): nodes dropped because a queue was full or a light array could not be allocated, the light around
+    // them stays wrong until it is updated again
+    uint64_t dropped;
+    double time_us;
+};
+
+// NOTE(max): flood fill light. Sky light enters from above at LIGHT_MAX and stays LIGHT_MAX going straight down,
+// block light starts at the Block_light_emission of the block. Every other step into an air block loses one level.
+// Light is kept in air blocks (and emitters), the mesher lights a face with the light of the block in front of it.
+// Removal is a second fill that clears everything the old light reached and hands the borders back to the add fill.
+struct Light_engine
+{
+    World *world;
+    Memory_arena *arena;
+    uint32_t seed;
+    Light_queue add;
+    Light_queue remove;
+    Light_stats stats;
+};
+
+struct Raycast_result
+{
+    bool collision;
+    float last_t;
+    Chunk *chunk;
+
+    int i;
+    int j;
+    int k;
+    
+    int last_i;
+    int last_j;
+    int last_k;
+};
+
+struct Game_state
+{
+    Memory_arena arena;
+    // NOTE(max): rest of the transient memory, reset every frame
+    Memory_arena frame_arena;
+
+	Skybox skybox;
+    ShaderProgram skyboxSP;
+	ShaderProgram sunSP;
+	ShaderProgram imageSP;
+	ShaderProgram inventoryBlockSP;
+	ShaderProgram mesh_sp;
+	ShaderProgram meshShadowMapSP;
+	ShadowMap shadowMap1;
+	ShadowMap shadowMap2;
+	ShadowMap shadowMap3;
+	ShadowMap shadowMap4;
+	Texture sunTexture;
+	Texture inventoryBarTexture;
+	Texture crossTexture;
+	GLuint cubeVAO;
+    GLuint cubeVBO;
+	GLuint squareVAO;
+	GLuint squareVBO;
+
+    Vec3f cam_pos;
+    Vec3f cam_view_dir;
+    Vec3f cam_move_dir;
+    Vec3f cam_up;
+    Vec3f cam_rot;
+
+    uint8_t block_to_place;
+    Mesher_mode mesher_mode;
+    Vertex_format vertex_format;
+    Job_system job_system;
+    Mesh_pool mesh_pool;
+    Gpu_buffer chunk_buffers[VERTEX_FORMAT_COUNT];
+    double rebuild_budget_us;
+    Rebuild_stats rebuild_stats;
+    uint32_t terrain_seed;
+    Streamer streamer;
+    Region_cache regions;
+    Render_stats render_stats;
+    Shadow_cascade shadow_cascades[SHADOW_CASCADE_COUNT];
+    int next_staggered_cascade;
+    // NOTE(max): of the last rendered frame, all planes are zero (everything inside) before the first one
+    Frustum camera_frustum;
+    // NOTE(max): the frame number cave_cull_chunks stamps on the chunks it reaches
+    uint32_t cave_frame;
+    // NOTE(max): the block under the crosshair, traced at most once per frame and again after an edit
+    Raycast_result camera_ray;
+    bool camera_ray_valid;
+    Light_engine light;
+
+    World world;
+};
+
+// NOTE(max): how far the camera picks blocks, the raycast itself is fine with rays of hundreds of blocks
+#define RAYCAST_PICK_DISTANCE 10.0f
+#define RAYCAST_BRICK_DIM_LOG2 2
+
+static_assert(CHUNK_DIM == 16, "raycast_box_log2 reads the rows of four z as one occupancy word");
+
+// NOTE(max): chunks that are empty or not loaded look at these, so the lookup does not branch on them
+static const uint64_t raycast_no_blocks[BLOCKS_IN_CHUNK / 64] = {};
+
+// NOTE(max): log2 of the size of the empty box around block v the ray crosses in one step, -1 for a solid block.
+// A 4x4x4 brick at a fixed y is 4 bits of each of the rows of z = bz..bz+3, which are one occupancy word.
+inline int raycast_box_log2(Chunk *c, const int *v)
+{
+    bool no_blocks = !c || (c->nblocks == 0);
+    const uint64_t *solid = no_blocks ? raycast_no_blocks : c->occupancy.solid;
+    int x = v[0] & (CHUNK_DIM - 1);
+    int y = v[1] & (CHUNK_DIM - 1);
+    int z = v[2] & (CHUNK_DIM - 1);
+    int brick_mask = ~((1 << RAYCAST_BRICK_DIM_LOG2) - 1);
+    const uint64_t *words = &solid[4 * (y & brick_mask) + (z >> 2)];
+    bool brick_empty = ((words[0] | words[4] | words[8] | words[12]) & (0x000F000F000F000Full << (x & brick_mask))) == 0;
+    int idx = CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x;
+    bool block_solid = (solid[idx >> 6] >> (idx & 63)) & 1;
+
+    return (no_blocks ? CHUNK_DIM_LOG2 : (brick_empty ? RAYCAST_BRICK_DIM_LOG2 : (block_solid ? -1 : 0)));
+}
+
+// NOTE(max): two level DDA. The ray crosses chunks that are empty or not loaded in one step and empty 4^3 bricks
+// in one step, only near solid blocks it goes block by block. Every step leaves the empty box around the current
+// block through its nearest face. The block across that face is exact on the exit axis and clamped into the box on
+// the others, so float error can not skip a block. i, j, k is the hit block, last_i, last_j, last_k the block the
+// ray was in before it (the same block if the ray starts inside a solid one) and last_t the distance to the hit.
+Raycast_result raycast(World *world, Vec3f pos, Vec3f dir, float max_len)
+{
+    Raycast_result result = {};
+
+    float len = sqrtf(dir.x * dir.x + dir.y * dir.y + dir.z * dir.z);
+    if (len < 1e-6f)
+    {
+        return (result);
+    }
+
+    float o[3] = {pos.x, pos.y, pos.z};
+    float d[3] = {dir.x / len, dir.y / len, dir.z / len};
+    int step[3];
+    float inv_d[3];
+    int v[3];
+    for (int a = 0; a < 3; a++)
+    {
+        step[a] = (d[a] > 0.0f) ? 1 : ((d[a] < 0.0f) ? -1 : 0);
+        inv_d[a] = step[a] ? 1.0f / d[a] : 0.0f;
+        v[a] = (int)floorf(o[a]);
+    }
+
+    static const int step_faces[3][2] =
+    {
+        {FACE_WEST, FACE_EAST},
+        {FACE_BOTTOM, FACE_TOP},
+        {FACE_NORTH, FACE_SOUTH},
+    };
+
+    int c_pos[3] = {v[0] >> CHUNK_DIM_LOG2, v[1] >> CHUNK_DIM_LOG2, v[2] >> CHUNK_DIM_LOG2};
+    Chunk *c = world_find_chunk(world, c_pos[0], c_pos[1], c_pos[2]);
+    int entry_axis = -1;
+    float t = 0.0f;
     for (;;)
     {
-        int chunk_x = i >> CHUNK_DIM_LOG2;
-        int chunk_y = j >> CHUNK_DIM_LOG2;
-        int chunk_z = k >> CHUNK_DIM_LOG2;
-        Chunk *c = world->next;
-        while (c != 0)
-        {
-            if ((chunk_x == c->x) && (chunk_y == c->y) && (chunk_z == c->z))
-            {
-                int mask = ~((~1) << (CHUNK_DIM_LOG2 - 1));
-                int block_x = i & mask;
-                int block_y = j & mask;
-                int block_z = k & mask;
+        int box_log2 = raycast_box_log2(c, v);
+        if (box_log2 < 0)
+        {
+            result.collision = true;
+            break;
+        }
+
+        int box_dim = 1 << box_log2;
+        int box_min[3];
+        int exit_axis = -1;
+        float t_exit = INFINITY;
+        for (int a = 0; a < 3; a++)
+        {
+            box_min[a] = v[a] & ~(box_dim - 1);
+            if (step[a])
+            {
+                int bound = (step[a] > 0) ? (box_min[a] + box_dim) : box_min[a];
+                float t_a = ((float)bound - o[a]) * inv_d[a];
+                if (t_a < t_exit)
+                {
+                    t_exit = t_a;
+                    exit_axis = a;
+                }
+            }
+        }
+
+        if ((exit_axis < 0) || (t_exit > max_len))
+        {
+            break;
+        }
+
+        t = std::max(t, t_exit);
+        for (int a = 0; a < 3; a++)
+        {
+            if (a == exit_axis)
+            {
+                v[a] = (step[a] > 0) ? (box_min[a] + box_dim) : (box_min[a] - 1);
+            }
+            else
+            {
+                int p = (int)floorf(o[a] + t * d[a]);
+                v[a] = std::min(std::max(p, box_min[a]), box_min[a] + box_dim - 1);
+            }
+        }
+        entry_axis = exit_axis;
+
+        // NOTE(max): only the exit axis can leave the chunk
+        int chunk_coord = v[exit_axis] >> CHUNK_DIM_LOG2;
+        if (chunk_coord != c_pos[exit_axis])
+        {
+            c_pos[exit_axis] = chunk_coord;
+            c = c ? c->neighbours[step_faces[exit_axis][step[exit_axis] > 0]]
+                  : world_find_chunk(world, c_pos[0], c_pos[1], c_pos[2]);
+        }
+    }
+
+    int last[3] = {v[0], v[1], v[2]};
+    if (result.collision && (entry_axis >= 0))
+    {
+        last[entry_axis] -= step[entry_axis];
+    }
+    result.i = v[0];
+    result.j = v[1];
+    result.k = v[2];
+    result.last_i = last[0];
+    result.last_j = last[1];
+    result.last_k = last[2];
+    result.last_t = result.collision ? t : 0.0f;
+    result.chunk = result.collision ? c : 0;
+
+    return (result);
+}
+
+// NOTE(max): rays in flight in raycast_batch, stepped four at a time with SSE2. More lanes than one register
+// keep more independent chunk lookups in flight.
+#define RAYCAST_LANES 8
+
+static_assert((RAYCAST_LANES % 4 == 0) && (RAYCAST_LANES <= 32), "raycast_batch steps groups of four lanes and keeps lane masks in an int");
+
+// NOTE(max): the rays raycast_batch is tracing, structure of arrays so the stepping runs on all lanes at once.
+// ray is the index of the lane's ray in the batch, -1 for an idle lane. Idle lanes have no direction, their exit
+// distance is infinite and they never step.
+struct Raycast_lanes
+{
+    int ray[RAYCAST_LANES];
+    float o[3][RAYCAST_LANES];
+    float d[3][RAYCAST_LANES];
+    float inv_d[3][RAYCAST_LANES];
+    int step[3][RAYCAST_LANES];
+    int v[3][RAYCAST_LANES];
+    int c_pos[3][RAYCAST_LANES];
+    int box_dim[RAYCAST_LANES];
+    int entry_axis[RAYCAST_LANES];
+    float t[RAYCAST_LANES];
+    Chunk *chunk[RAYCAST_LANES];
+};
+
+void raycast_lane_clear(Raycast_lanes *l, int lane)
+{
+    l->ray[lane] = -1;
+    for (int a = 0; a < 3; a++)
+    {
+        l->o[a][lane] = 0.0f;
+        l->d[a][lane] = 0.0f;
+        l->inv_d[a][lane] = 0.0f;
+        l->step[a][lane] = 0;
+        l->v[a][lane] = 0;
+        l->c_pos[a][lane] = 0;
+    }
+    l->box_dim[lane] = 1;
+    l->entry_axis[lane] = -1;
+    l->t[lane] = 0.0f;
+    l->chunk[lane] = 0;
+}
+
+// NOTE(max): false for a ray without direction, it hits nothing and does not take the lane
+bool raycast_lane_start(Raycast_lanes *l, int lane, World *world, int ray, Vec3f pos, Vec3f dir)
+{
+    float len = sqrtf(dir.x * dir.x + dir.y * dir.y + dir.z * dir.z);
+    if (len < 1e-6f)
+    {
+        return (false);
+    }
+
+    float o[3] = {pos.x, pos.y, pos.z};
+    float d[3] = {dir.x / len, dir.y / len, dir.z / len};
+    for (int a = 0; a < 3; a++)
+    {
+        int step = (d[a] > 0.0f) ? 1 : ((d[a] < 0.0f) ? -1 : 0);
+        l->o[a][lane] = o[a];
+        l->d[a][lane] = d[a];
+        l->inv_d[a][lane] = step ? 1.0f / d[a] : 0.0f;
+        l->step[a][lane] = step;
+        l->v[a][lane] = (int)floorf(o[a]);
+        l->c_pos[a][lane] = l->v[a][lane] >> CHUNK_DIM_LOG2;
+    }
+    l->ray[lane] = ray;
+    l->entry_axis[lane] = -1;
+    l->t[lane] = 0.0f;
+    l->chunk[lane] = world_find_chunk(world, l->c_pos[0][lane], l->c_pos[1][lane], l->c_pos[2][lane]);
+
+    return (true);
+}
+
+void raycast_lane_finish(Raycast_lanes *l, int lane, bool collision, Raycast_result *result)
+{
+    int last[3] = {l->v[0][lane], l->v[1][lane], l->v[2][lane]};
+    int entry_axis = l->entry_axis[lane];
+    if (collision && (entry_axis >= 0))
+    {
+        last[entry_axis] -= l->step[entry_axis][lane];
+    }
+
+    *result = {};
+    result->collision = collision;
+    result->i = l->v[0][lane];
+    result->j = l->v[1][lane];
+    result->k = l->v[2][lane];
+    result->last_i = last[0];
+    result->last_j = last[1];
+    result->last_k = last[2];
+    result->last_t = collision ? l->t[lane] : 0.0f;
+    result->chunk = collision ? l->chunk[lane] : 0;
+}
+
+// NOTE(max): the box of the lane's block, false if the block is solid
+inline bool raycast_lane_box(Raycast_lanes *l, int lane)
+{
+    int v[3] = {l->v[0][lane], l->v[1][lane], l->v[2][lane]};
+    int box_log2 = raycast_box_log2(l->chunk[lane], v);
+    l->box_dim[lane] = 1 << std::max(box_log2, 0);
+    return (box_log2 >= 0);
+}
+
+// NOTE(max): gives a free lane the next ray of the batch that does not end where it starts, false when there is none
+bool raycast_lane_refill(Raycast_lanes *l, int lane, World *world, const Vec3f *origins, const Vec3f *dirs, int count,
+                         int *next_ray, Raycast_result *results)
+{
+    while (*next_ray < count)
+    {
+        int ray = (*next_ray)++;
+        if (!raycast_lane_start(l, lane, world, ray, origins[ray], dirs[ray]))
+        {
+            results[ray] = {};
+            continue;
+        }
+        if (raycast_lane_box(l, lane))
+        {
+            return (true);
+        }
+        raycast_lane_finish(l, lane, true, &results[ray]);
+    }
+    raycast_lane_clear(l, lane);
+
+    return (false);
+}
+
+// NOTE(max): traces count rays with the same stepping as raycast and the same results, RAYCAST_LANES of them in
+// lockstep. Looking up chunks and occupancy is a gather and stays per lane, the box exit, the step to the next
+// block and the chunk crossing test run on four lanes at a time with SSE2. A lane whose ray ends takes the next ray of the
+// batch right away, so short and long rays can be mixed.
+void raycast_batch(World *world, const Vec3f *origins, const Vec3f *dirs, int count, float max_len,
+                   Raycast_result *results)
+{
+    static const int step_faces[3][2] =
+    {
+        {FACE_WEST, FACE_EAST},
+        {FACE_BOTTOM, FACE_TOP},
+        {FACE_NORTH, FACE_SOUTH},
+    };
+
+    Raycast_lanes l;
+    int next_ray = 0;
+    int active = 0;
+    for (int lane = 0; lane < RAYCAST_LANES; lane++)
+    {
+        if (raycast_lane_refill(&l, lane, world, origins, dirs, count, &next_ray, results))
+        {
+            active |= 1 << lane;
+        }
+    }
+
+    const __m128 max_len_x4 = _mm_set1_ps(max_len);
+    const __m128 inf_x4 = _mm_set1_ps(INFINITY);
+    const __m128i zero_x4 = _mm_setzero_si128();
+    const __m128i one_x4 = _mm_set1_epi32(1);
+    while (active)
+    {
+        int ended_mask = 0;
+        int crossed_mask = 0;
+        for (int g = 0; g < RAYCAST_LANES; g += 4)
+        {
+            __m128i box_dim = _mm_loadu_si128((__m128i *)&l.box_dim[g]);
+            __m128i box_min[3];
+            __m128i step[3];
+            __m128 t_axis[3];
+            for (int a = 0; a < 3; a++)
+            {
+                box_min[a] = _mm_and_si128(_mm_loadu_si128((__m128i *)&l.v[a][g]), _mm_sub_epi32(zero_x4, box_dim));
+                step[a] = _mm_loadu_si128((__m128i *)&l.step[a][g]);
+                __m128i bound = _mm_add_epi32(box_min[a], _mm_and_si128(_mm_cmpgt_epi32(step[a], zero_x4), box_dim));
+                __m128 t_a = _mm_mul_ps(_mm_sub_ps(_mm_cvtepi32_ps(bound), _mm_loadu_ps(&l.o[a][g])), _mm_loadu_ps(&l.inv_d[a][g]));
+                __m128 still = _mm_castsi128_ps(_mm_cmpeq_epi32(step[a], zero_x4));
+                t_axis[a] = _mm_or_ps(_mm_and_ps(still, inf_x4), _mm_andnot_ps(still, t_a));
+            }
+
+            // NOTE(max): the first axis wins ties like in raycast
+            __m128 exit_y = _mm_cmplt_ps(t_axis[1], t_axis[0]);
+            __m128 t_xy = _mm_or_ps(_mm_and_ps(exit_y, t_axis[1]), _mm_andnot_ps(exit_y, t_axis[0]));
+            __m128 exit_z = _mm_cmplt_ps(t_axis[2], t_xy);
+            __m128 t_exit = _mm_or_ps(_mm_and_ps(exit_z, t_axis[2]), _mm_andnot_ps(exit_z, t_xy));
+            __m128i exit_axis[3];
+            exit_axis[2] = _mm_castps_si128(exit_z);
+            exit_axis[1] = _mm_andnot_si128(exit_axis[2], _mm_castps_si128(exit_y));
+            exit_axis[0] = _mm_cmpeq_epi32(_mm_or_si128(exit_axis[1], exit_axis[2]), zero_x4);
+            _mm_storeu_si128((__m128i *)&l.entry_axis[g],
+                             _mm_sub_epi32(zero_x4, _mm_add_epi32(exit_axis[1], _mm_add_epi32(exit_axis[2], exit_axis[2]))));
+
+            // NOTE(max): lanes that would step past max_len end where they are
+            __m128i ended = _mm_castps_si128(_mm_cmpgt_ps(t_exit, max_len_x4));
+            __m128 t_old = _mm_loadu_ps(&l.t[g]);
+            __m128 t = _mm_max_ps(t_old, t_exit);
+            _mm_storeu_ps(&l.t[g], _mm_or_ps(_mm_and_ps(_mm_castsi128_ps(ended), t_old),
+                                             _mm_andnot_ps(_mm_castsi128_ps(ended), t)));
+            __m128i crossed = zero_x4;
+            for (int a = 0; a < 3; a++)
+            {
+                __m128i box_max = _mm_sub_epi32(_mm_add_epi32(box_min[a], box_dim), one_x4);
+                __m128 p = _mm_add_ps(_mm_loadu_ps(&l.o[a][g]), _mm_mul_ps(t, _mm_loadu_ps(&l.d[a][g])));
+                __m128i inside = simd_min_epi32(simd_max_epi32(_mm_cvttps_epi32(simd_floor(p)), box_min[a]), box_max);
+                __m128i across = simd_select_epi32(_mm_cmpgt_epi32(step[a], zero_x4), _mm_add_epi32(box_max, one_x4),
+                                                   _mm_sub_epi32(box_min[a], one_x4));
+                __m128i v = simd_select_epi32(exit_axis[a], across, inside);
+                v = simd_select_epi32(ended, _mm_loadu_si128((__m128i *)&l.v[a][g]), v);
+                _mm_storeu_si128((__m128i *)&l.v[a][g], v);
+
+                __m128i c_pos = _mm_loadu_si128((__m128i *)&l.c_pos[a][g]);
+                __m128i c_new = _mm_srai_epi32(v, CHUNK_DIM_LOG2);
+                crossed = _mm_or_si128(crossed, _mm_andnot_si128(_mm_cmpeq_epi32(c_pos, c_new), exit_axis[a]));
+                _mm_storeu_si128((__m128i *)&l.c_pos[a][g], c_new);
+            }
+
+            ended_mask |= _mm_movemask_ps(_mm_castsi128_ps(ended)) << g;
+            crossed_mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_andnot_si128(ended, crossed))) << g;
+        }
+        ended_mask &= active;
+        crossed_mask &= active;
+
+        // NOTE(max): most steps stay in the chunk and in the empty space, only the other lanes go on one by one
+        while (crossed_mask)
+        {
+            int lane = ctz32(crossed_mask);
+            crossed_mask &= crossed_mask - 1;
+
+            // NOTE(max): only the exit axis can leave the chunk
+            int a = l.entry_axis[lane];
+            l.chunk[lane] = l.chunk[lane] ? l.chunk[lane]->neighbours[step_faces[a][l.step[a][lane] > 0]]
+                                          : world_find_chunk(world, l.c_pos[0][lane], l.c_pos[1][lane], l.c_pos[2][lane]);
+        }
+
+        int hit_mask = 0;
+        for (int lane = 0; lane < RAYCAST_LANES; lane++)
+        {
+            if ((active & ~ended_mask) & (1 << lane))
+            {
+                hit_mask |= raycast_lane_box(&l, lane) ? 0 : (1 << lane);
+            }
+        }
+
+        int done_mask = ended_mask | hit_mask;
+        while (done_mask)
+        {
+            int lane = ctz32(done_mask);
+            done_mask &= done_mask - 1;
+
+            raycast_lane_finish(&l, lane, (hit_mask >> lane) & 1, &results[l.ray[lane]]);
+            if (!raycast_lane_refill(&l, lane, world, origins, dirs, count, &next_ray, results))
+            {
+                active &= ~(1 << lane);
+            }
+        }
+    }
+}
+
+struct Range3d
+{
+    uint8_t type;
+
+    int start_x;
+    int start_y;
+    int start_z;
+
+    int end_x;
+    int end_y;
+    int end_z;
+};
+
+void gen_ranges_3d(uint8_t *blocks, Range3d *ranges, uint8_t *visited, int dim, int count, int *num_of_ranges)
+{
+    int ranges_count = 0;
+
+    while (count > 0)
+    {
+        int start_z = 0;
+        int end_z = 0;
+
+        int start_y = 0;
+        int end_y = 0;
+
+        int start_x = 0;
+        int end_x = 0;
+
+        // skip all visited and empty blocks
+        for (start_y = 0; start_y < dim; start_y++)
+        {
+            for (start_z = 0; start_z < dim; start_z++)
+            {
+                for (start_x = 0; start_x < dim; start_x++)
+                {
+                    if (visited[start_y * dim * dim + start_z * dim + start_x] == 0 &&
+                        blocks[start_y * dim * dim + start_z * dim + start_x] != BLOCK_AIR)
+                    {
+                        goto break1;
+                    }
+                }
+            }
+        }
+    break1:
+
+        // If a block at (start_x, start_y, start_z) is in the grid (the grid is not empty), mark it as visited.
+        // Also record block type.
+        uint8_t block_type = BLOCK_AIR;
+        if (start_x < dim && start_y < dim && start_z < dim)
+        {
+            visited[start_y * dim * dim + start_z * dim + start_x] = 1;
+            block_type = blocks[start_y * dim * dim + start_z * dim + start_x];
+            count--;
+        }
+
+        // try expand in x direction
+        end_x = start_x;
+        while ((end_x + 1 < dim) &&
+            (blocks[start_y * dim * dim + start_z * dim + (end_x + 1)] == block_type) &&
+            (visited[start_y * dim * dim + start_z * dim + (end_x + 1)] == 0))
+        {
+            visited[start_y * dim * dim + start_z * dim + (end_x + 1)] = 1;
+            end_x++;
+            count--;
+        }
+
+        // try expand in z direction
+        end_z = start_z;
+        while (end_z + 1 < dim)
+        {
+            bool can_expand = true;
+            for (int x = start_x; x <= end_x; x++)
+            {
+                if (blocks[start_y * dim * dim + (end_z + 1) * dim + x] != block_type ||
+                    visited[start_y * dim * dim + (end_z + 1) * dim + x] == 1)
+                {
+                    can_expand = false;
+                    break;
+                }
+            }
+
+            if (can_expand)
+            {
+                // mark expanded row of block as visited
+                for (int x = start_x; x <= end_x; x++)
+                {
+                    visited[start_y * dim * dim + (end_z + 1) * dim + x] = 1;
+                }
+                end_z++;
+                count -= end_x - start_x + 1;
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        // try expand in y direction
+        end_y = start_y;
+        while (end_y + 1 < dim)
+        {
+            bool can_expand = true;
+            for (int z = start_z; z <= end_z; z++)
+            {
+                for (int x = start_x; x <= end_x; x++)
+                {
+                    if (blocks[(end_y + 1) * dim * dim + z * dim + x] != block_type ||
+                        visited[(end_y + 1) * dim * dim + z * dim + x] == 1)
+                    {
+                        can_expand = false;
+                        goto break2;
+                    }
+                }
+            }
+        break2:
+            if (can_expand)
+            {
+                for (int z = start_z; z <= end_z; z++)
+                {
+                    for (int x = start_x; x <= end_x; x++)
+                    {
+                        visited[(end_y + 1) * dim * dim + z * dim + x] = 1;
+                    }
+                }
+                end_y++;
+                count -= (end_x - start_x + 1) * (end_z - start_z + 1);
+            }
+            else
+            {
+                break;
+            }
+        }
+
+        assert(block_type != BLOCK_AIR);
+        ranges[ranges_count++] = { block_type, start_x, start_y, start_z, end_x, end_y, end_z };
+    }
+
+    assert(count == 0);
+    *num_of_ranges = ranges_count;
+}
+
+// NOTE(max): blocks and light of the chunk being meshed plus those of its six neighbours (0 if the neighbour is not
+// loaded)
+struct Mesher_input
+{
+    int nblocks;
+    uint8_t *blocks;
+    uint8_t *neighbours[FACE_COUNT];
+    uint8_t *light;
+    uint8_t *neighbour_light[FACE_COUNT];
+};
+
+// NOTE(max): faces towards a chunk that is not loaded are lit like open sky
+#define LIGHT_UNLOADED (LIGHT_MAX << LIGHT_SKY_SHIFT)
+
+// NOTE(max): light of the block in front of face of block p, it is in the neighbour across the face if p is on the
+// border. Light arrays are laid out like blocks, 0 arrays count as unloaded.
+inline uint8_t face_light(uint8_t *light, uint8_t **neighbour_light, int dim, int face, const int *p)
+{
+    int q[3] = { p[0] + Face_normals[face][0], p[1] + Face_normals[face][1], p[2] + Face_normals[face][2] };
+    for (int a = 0; a < 3; a++)
+    {
+        if ((q[a] < 0) || (q[a] >= dim))
+        {
+            light = neighbour_light[face];
+            q[a] = (q[a] + dim) % dim;
+        }
+    }
+
+    return (light ? light[dim * dim * q[1] + dim * q[2] + q[0]] : (uint8_t)LIGHT_UNLOADED);
+}
+
+// NOTE(max): coordinates may be out of the chunk by one along a single axis
+uint8_t mesher_get_block(Mesher_input *in, int x, int y, int z)
+{
+    uint8_t *blocks = in->blocks;
+    if (x < 0)               { blocks = in->neighbours[FACE_WEST];   x += CHUNK_DIM; }
+    else if (x >= CHUNK_DIM) { blocks = in->neighbours[FACE_EAST];   x -= CHUNK_DIM; }
+    else if (y < 0)          { blocks = in->neighbours[FACE_BOTTOM]; y += CHUNK_DIM; }
+    else if (y >= CHUNK_DIM) { blocks = in->neighbours[FACE_TOP];    y -= CHUNK_DIM; }
+    else if (z < 0)          { blocks = in->neighbours[FACE_NORTH];  z += CHUNK_DIM; }
+    else if (z >= CHUNK_DIM) { blocks = in->neighbours[FACE_SOUTH];  z -= CHUNK_DIM; }
+
+    return (blocks ? blocks[CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x] : (uint8_t)BLOCK_AIR);
+}
+
+// NOTE(max): two triangles per face, corners are multipliers of the box dimensions
+int Face_corners[FACE_COUNT][6][3] =
+{
+    { {0, 0, 0}, {1, 0, 0}, {0, 0, 1},   {0, 0, 1}, {1, 0, 0}, {1, 0, 1} }, // bottom
+    { {0, 1, 0}, {0, 1, 1}, {1, 1, 0},   {0, 1, 1}, {1, 1, 1}, {1, 1, 0} }, // top
+    { {0, 0, 0}, {0, 1, 0}, {1, 1, 0},   {0, 0, 0}, {1, 1, 0}, {1, 0, 0} }, // north
+    { {0, 0, 1}, {1, 1, 1}, {0, 1, 1},   {0, 0, 1}, {1, 0, 1}, {1, 1, 1} }, // south
+    { {0, 0, 0}, {0, 1, 1}, {0, 1, 0},   {0, 0, 0}, {0, 0, 1}, {0, 1, 1} }, // west
+    { {1, 0, 0}, {1, 1, 0}, {1, 1, 1},   {1, 0, 0}, {1, 1, 1}, {1, 0, 1} }, // east
+};
+
+// NOTE(max): interleaved float layout, attributes 0 (position), 1 (normal), 3 (block type) and 4 (light, as in the
+// packed layout)
+struct Float_vertex
+{
+    Vec3f pos;
+    Vec3f normal;
+    uint32_t type;
+    uint32_t light;
+};
+
+// NOTE(max): all block types of a chunk go into one buffer, vs is Float_vertex[] or uint32_t[] depending on format
+struct Chunk_mesh_data
+{
+    Vertex_format format;
+    int num_of_vs;
+    int max_vs;
+    void *vs;
+};
+
+bool mesh_data_alloc(Chunk_mesh_data *out, Vertex_format format, int max_vs, Memory_arena *arena)
+{
+    out->format = format;
+    out->num_of_vs = 0;
+    out->max_vs = max_vs;
+    out->vs = 0;
+
+    if (max_vs > 0)
+    {
+        int vertex_size = (format == VERTEX_FORMAT_PACKED) ? sizeof(uint32_t) : sizeof(Float_vertex);
+        out->vs = memory_arena_alloc(arena, max_vs * vertex_size);
+    }
+
+    return ((max_vs == 0) || (out->vs != 0));
+}
+
+// NOTE(max): writes one face of the box [start, end] (inclusive block coordinates)
+void emit_box_face(Chunk_mesh_data *out, int face, int type, int light, int *start, int *end)
+{
+    assert(out->num_of_vs + 6 <= out->max_vs);
+
+    int dim[3];
+    for (int a = 0; a < 3; a++)
+    {
+        dim[a] = end[a] - start[a] + 1;
+    }
+
+    for (int v = 0; v < 6; v++)
+    {
+        int *corner = Face_corners[face][v];
+        int x = start[0] + corner[0] * dim[0];
+        int y = start[1] + corner[1] * dim[1];
+        int z = start[2] + corner[2] * dim[2];
+
+        if (out->format == VERTEX_FORMAT_PACKED)
+        {
+            ((uint32_t *)out->vs)[out->num_of_vs++] = pack_vertex(x, y, z, face, type, light);
+        }
+        else
+        {
+            Float_vertex *fv = &((Float_vertex *)out->vs)[out->num_of_vs++];
+            fv->pos = Vec3f((float)x, (float)y, (float)z);
+            fv->normal = Vec3f((float)Face_normals[face][0], (float)Face_normals[face][1], (float)Face_normals[face][2]);
+            fv->type = (uint32_t)type;
+            fv->light = (uint32_t)light;
+        }
+    }
+}
+
+// NOTE(max): upper bound of vertices mesh_ranges can write for these ranges
+int mesher_max_vertices(Range3d *ranges, int nranges, Mesher_mode mode)
+{
+    int result = 0;
+    for (int i = 0; i < nranges; i++)
+    {
+        if (mode == MESHER_VOLUME)
+        {
+            result += 3 * 12;
+        }
+        else
+        {
+            int dx = ranges[i].end_x - ranges[i].start_x + 1;
+            int dy = ranges[i].end_y - ranges[i].start_y + 1;
+            int dz = ranges[i].end_z - ranges[i].start_z + 1;
+            result += 6 * 2 * (dx * dy + dy * dz + dz * dx);
+        }
+    }
+
+    return (result);
+}
+
+// NOTE(max): in MESHER_SURFACE mode a range face is cut into the cells that have air in front of them,
+// and those cells are merged back into rectangles greedily. Faces are not split by light here, a face takes the
+// light in front of its first cell.
+void mesh_ranges(Mesher_input *in, Range3d *ranges, int nranges, Mesher_mode mode, Chunk_mesh_data *out)
+{
+    static_assert(CHUNK_DIM <= 32, "face rows are stored in uint32_t");
+
+    for (int i = 0; i < nranges; i++)
+    {
+        int start[3] = { ranges[i].start_x, ranges[i].start_y, ranges[i].start_z };
+        int end[3]   = { ranges[i].end_x, ranges[i].end_y, ranges[i].end_z };
+
+        for (int f = 0; f < FACE_COUNT; f++)
+        {
+            if (mode == MESHER_VOLUME)
+            {
+                emit_box_face(out, f, ranges[i].type, face_light(in->light, in->neighbour_light, CHUNK_DIM, f, start), start, end);
+                continue;
+            }
+
+            // a - normal axis, u and v - axes of the face plane
+            int a = (f == FACE_WEST || f == FACE_EAST) ? 0 : ((f == FACE_BOTTOM || f == FACE_TOP) ? 1 : 2);
+            int u = (a == 0) ? 1 : 0;
+            int v = (a == 2) ? 1 : 2;
+
+            // bit (p[u] - start[u]) of rows[p[v] - start[v]] is set when the cell is exposed
+            uint32_t rows[CHUNK_DIM];
+            int nrows = end[v] - start[v] + 1;
+
+            int p[3];
+            p[a] = (Face_normals[f][a] < 0) ? (start[a] - 1) : (end[a] + 1);
+            for (p[v] = start[v]; p[v] <= end[v]; p[v]++)
+            {
+                uint32_t row = 0;
+                for (p[u] = start[u]; p[u] <= end[u]; p[u]++)
+                {
+                    if (mesher_get_block(in, p[0], p[1], p[2]) == BLOCK_AIR)
+                    {
+                        row |= 1u << (p[u] - start[u]);
+                    }
+                }
+                rows[p[v] - start[v]] = row;
+            }
+
+            for (int r = 0; r < nrows; r++)
+            {
+                while (rows[r])
+                {
+                    int run_start = ctz32(rows[r]);
+                    uint32_t rest = ~(rows[r] >> run_start);
+                    int run_len = rest ? ctz32(rest) : (32 - run_start);
+                    uint32_t run = (run_len == 32) ? ~0u : (((1u << run_len) - 1) << run_start);
+
+                    int r_end = r;
+                    while ((r_end + 1 < nrows) && ((rows[r_end + 1] & run) == run))
+                    {
+                        r_end++;
+                    }
+                    for (int k = r; k <= r_end; k++)
+                    {
+                        rows[k] &= ~run;
+                    }
+
+                    int face_start[3] = { start[0], start[1], start[2] };
+                    int face_end[3]   = { end[0], end[1], end[2] };
+                    face_start[u] = start[u] + run_start;
+                    face_end[u]   = start[u] + run_start + run_len - 1;
+                    face_start[v] = start[v] + r;
+                    face_end[v]   = start[v] + r_end;
+                    emit_box_face(out, f, ranges[i].type,
+                                  face_light(in->light, in->neighbour_light, CHUNK_DIM, f, face_start), face_start, face_end);
+                }
+            }
+        }
+    }
+}
+
+struct Quad
+{
+    uint8_t face;
+    uint8_t type;
+    uint8_t light;
+
+    // NOTE(max): corner with the smallest coordinates and extents along the two axes of the face plane
+    uint8_t x;
+    uint8_t y;
+    uint8_t z;
+    uint8_t w;
+    uint8_t h;
+};
+
+// NOTE(max): a - normal axis of the face, u and v - axes of the face plane (same convention as mesh_ranges)
+inline void face_axes(int face, int *a, int *u, int *v)
+{
+    *a = (face == FACE_WEST || face == FACE_EAST) ? 0 : ((face == FACE_BOTTOM || face == FACE_TOP) ? 1 : 2);
+    *u = (*a == 0) ? 1 : 0;
+    *v = (*a == 2) ? 1 : 2;
+}
+
+// NOTE(max): binary greedy mesher.
+// 1. For every axis build a column bitmask of solid blocks along it, padded with one bit from each neighbour chunk.
+// 2. Exposed faces of a column are col & ~(col >> 1) (positive direction) and col & ~(col << 1) (negative direction).
+// 3. Exposed cells are scattered into per block type slices of rows (one word per row), and every slice is
+//    merged greedily: ctz finds the start of a run, extend it down while the next rows contain the whole run.
+//    Runs are cut where the light in front of the faces changes, so every quad has a single light.
+// Works for any dim <= 62, neighbours and light have to use the same dim (light may be 0, then everything is lit
+// like open sky). Quads are allocated from the arena.
+bool greedy_mesh_chunk(uint8_t *blocks, uint8_t **neighbours, uint8_t *light, uint8_t **neighbour_light, int dim,
+                       Memory_arena *arena, Quad **out_quads, int *out_nquads)
+{
+    assert(dim > 0 && dim <= 62);
+
+    *out_quads = 0;
+    *out_nquads = 0;
+
+    uint64_t *cols   = (uint64_t *)memory_arena_alloc(arena, 3 * dim * dim * sizeof(uint64_t));
+    uint64_t *planes = (uint64_t *)memory_arena_alloc(arena, BLOCK_TYPE_COUNT * dim * dim * sizeof(uint64_t));
+    if (!cols || !planes)
+    {
+        return (false);
+    }
+
+    for (int i = 0; i < 3 * dim * dim; i++) cols[i] = 0;
+    for (int i = 0; i < BLOCK_TYPE_COUNT * dim * dim; i++) planes[i] = 0;
+
+    uint64_t *cols_x = cols;                 // [z][y], bit x + 1
+    uint64_t *cols_y = cols + dim * dim;     // [z][x], bit y + 1
+    uint64_t *cols_z = cols + 2 * dim * dim; // [y][x], bit z + 1
+
+    for (int y = 0; y < dim; y++)
+    {
+        for (int z = 0; z < dim; z++)
+        {
+            uint8_t *row = &blocks[dim * dim * y + dim * z];
+            uint64_t *row_y = &cols_y[z * dim];
+            uint64_t *row_z = &cols_z[y * dim];
+
+            uint64_t col_x = 0;
+            for (int x = 0; x < dim; x++)
+            {
+                uint64_t solid = (row[x] != BLOCK_AIR);
+                col_x    |= solid << (x + 1);
+                row_y[x] |= solid << (y + 1);
+                row_z[x] |= solid << (z + 1);
+            }
+            cols_x[z * dim + y] = col_x;
+        }
+    }
+
+    uint64_t hi_bit = 1ull << (dim + 1);
+    for (int i = 0; i < dim; i++)
+    {
+        for (int j = 0; j < dim; j++)
+        {
+            // NOTE(max): a missing neighbour is air
+            uint8_t *n;
+            if ((n = neighbours[FACE_WEST])   && n[dim * dim * j + dim * i + (dim - 1)] != BLOCK_AIR) cols_x[i * dim + j] |= 1;
+            if ((n = neighbours[FACE_EAST])   && n[dim * dim * j + dim * i + 0] != BLOCK_AIR)         cols_x[i * dim + j] |= hi_bit;
+            if ((n = neighbours[FACE_BOTTOM]) && n[dim * dim * (dim - 1) + dim * i + j] != BLOCK_AIR) cols_y[i * dim + j] |= 1;
+            if ((n = neighbours[FACE_TOP])    && n[dim * dim * 0 + dim * i + j] != BLOCK_AIR)         cols_y[i * dim + j] |= hi_bit;
+            if ((n = neighbours[FACE_NORTH])  && n[dim * dim * i + dim * (dim - 1) + j] != BLOCK_AIR) cols_z[i * dim + j] |= 1;
+            if ((n = neighbours[FACE_SOUTH])  && n[dim * dim * i + dim * 0 + j] != BLOCK_AIR)         cols_z[i * dim + j] |= hi_bit;
+        }
+    }
+
+    uint64_t dim_mask = (1ull << dim) - 1;
+
+    // every exposed cell ends up in at most one quad
+    int max_quads = 0;
+    for (int f = 0; f < FACE_COUNT; f++)
+    {
+        int a, u, v;
+        face_axes(f, &a, &u, &v);
+        uint64_t *axis_cols = cols + a * dim * dim;
+        for (int i = 0; i < dim * dim; i++)
+        {
+            uint64_t c = axis_cols[i];
+            uint64_t exposed = (Face_normals[f][a] < 0) ? (c & ~(c << 1)) : (c & ~(c >> 1));
+            max_quads += popcount64((exposed >> 1) & dim_mask);
+        }
+    }
+
+    if (max_quads == 0)
+    {
+        return (true);
+    }
+
+    Quad *quads = (Quad *)memory_arena_alloc(arena, max_quads * sizeof(Quad));
+    if (!quads)
+    {
+        return (false);
+    }
+
+    int nquads = 0;
+    for (int f = 0; f < FACE_COUNT; f++)
+    {
+        int a, u, v;
+        face_axes(f, &a, &u, &v);
+        uint64_t *axis_cols = cols + a * dim * dim;
+
+        // planes[type][d][row v], bit u; slices_used[type] has bit d set for non empty slices
+        uint64_t slices_used[BLOCK_TYPE_COUNT] = {};
+        for (int cv = 0; cv < dim; cv++)
+        {
+            for (int cu = 0; cu < dim; cu++)
+            {
+                uint64_t c = axis_cols[cv * dim + cu];
+                uint64_t exposed = (Face_normals[f][a] < 0) ? (c & ~(c << 1)) : (c & ~(c >> 1));
+                exposed = (exposed >> 1) & dim_mask;
+                while (exposed)
+                {
+                    int d = ctz64(exposed);
+                    exposed &= exposed - 1;
+
+                    int p[3];
+                    p[a] = d;
+                    p[u] = cu;
+                    p[v] = cv;
+                    uint8_t type = blocks[dim * dim * p[1] + dim * p[2] + p[0]];
+                    assert(type < BLOCK_TYPE_COUNT);
+
+                    planes[(type * dim + d) * dim + cv] |= 1ull << cu;
+                    slices_used[type] |= 1ull << d;
+                }
+            }
+        }
+
+        for (int type = 0; type < BLOCK_TYPE_COUNT; type++)
+        {
+            while (slices_used[type])
+            {
+                int d = ctz64(slices_used[type]);
+                slices_used[type] &= slices_used[type] - 1;
+
+                uint64_t *rows = &planes[(type * dim + d) * dim];
+                for (int r = 0; r < dim; r++)
+                {
+                    while (rows[r])
+                    {
+                        int run_start = ctz64(rows[r]);
+                        uint64_t rest = ~(rows[r] >> run_start);
+                        int run_len = rest ? ctz64(rest) : (64 - run_start);
+
+                        int p[3];
+                        p[a] = d;
+                        p[u] = run_start;
+                        p[v] = r;
+                        uint8_t run_light = face_light(light, neighbour_light, dim, f, p);
+                        if (light)
+                        {
+                            for (int k = 1; k < run_len; k++)
+                            {
+                                p[u] = run_start + k;
+                                if (face_light(light, neighbour_light, dim, f, p) != run_light)
+                                {
+                                    run_len = k;
+                                    break;
+                                }
+                            }
+                        }
+                        uint64_t run = ((run_len == 64) ? ~0ull : ((1ull << run_len) - 1)) << run_start;
+
+                        int r_end = r;
+                        while ((r_end + 1 < dim) && ((rows[r_end + 1] & run) == run))
+                        {
+                            bool same_light = true;
+                            p[v] = r_end + 1;
+                            for (int k = 0; light && same_light && (k < run_len); k++)
+                            {
+                                p[u] = run_start + k;
+                                same_light = face_light(light, neighbour_light, dim, f, p) == run_light;
+                            }
+                            if (!same_light)
+                            {
+                                break;
+                            }
+                            r_end++;
+                        }
+                        // NOTE(max): this also leaves the planes zeroed for the next face
+                        for (int k = r; k <= r_end; k++)
+                        {
+                            rows[k] &= ~run;
+                        }
+
+                        p[u] = run_start;
+                        p[v] = r;
+
+                        assert(nquads < max_quads);
+                        Quad *q = &quads[nquads++];
+                        q->face = (uint8_t)f;
+                        q->type = (uint8_t)type;
+                        q->light = run_light;
+                        q->x = (uint8_t)p[0];
+                        q->y = (uint8_t)p[1];
+                        q->z = (uint8_t)p[2];
+                        q->w = (uint8_t)run_len;
+                        q->h = (uint8_t)(r_end - r + 1);
+                    }
+                }
+            }
+        }
+    }
+
+    *out_quads = quads;
+    *out_nquads = nquads;
+    return (true);
+}
+
+// NOTE(max): writes the quad as one face of a box one block thick
+void emit_quad(Chunk_mesh_data *out, Quad *q)
+{
+    int a, u, v;
+    face_axes(q->face, &a, &u, &v);
+
+    int start[3] = { q->x, q->y, q->z };
+    int end[3]   = { q->x, q->y, q->z };
+    end[u] += q->w - 1;
+    end[v] += q->h - 1;
+
+    emit_box_face(out, q->face, q->type, q->light, start, end);
+}
+
+// NOTE(max): everything (scratch and output) is allocated from the arena
+bool mesh_chunk(Mesher_input *in, Mesher_mode mode, Vertex_format format, Memory_arena *arena, Chunk_mesh_data *out)
+{
+    if (mode == MESHER_GREEDY)
+    {
+        Quad *quads = 0;
+        int nquads = 0;
+        if (!greedy_mesh_chunk(in->blocks, in->neighbours, in->light, in->neighbour_light, CHUNK_DIM, arena, &quads, &nquads))
+        {
+            return (false);
+        }
+
+        if (!mesh_data_alloc(out, format, 6 * nquads, arena))
+        {
+            return (false);
+        }
+
+        for (int i = 0; i < nquads; i++)
+        {
+            emit_quad(out, &quads[i]);
+        }
+
+        return (true);
+    }
+
+    Range3d *ranges  = (Range3d *)memory_arena_alloc(arena, BLOCKS_IN_CHUNK * sizeof(Range3d));
+    uint8_t *visited = (uint8_t *)memory_arena_alloc(arena, BLOCKS_IN_CHUNK * sizeof(uint8_t));
+    if (!ranges || !visited)
+    {
+        return (false);
+    }
+
+    for (int i = 0; i < (BLOCKS_IN_CHUNK); i++) visited[i] = 0;
+
+    int nranges = 0;
+    gen_ranges_3d(in->blocks, ranges, visited, CHUNK_DIM, in->nblocks, &nranges);
+
+    if (!mesh_data_alloc(out, format, mesher_max_vertices(ranges, nranges, mode), arena))
+    {
+        return (false);
+    }
+
+    mesh_ranges(in, ranges, nranges, mode, out);
+
+    return (true);
+}
+
+// NOTE(max): flood fills every air region of the chunk and links all the faces the region touches
+uint64_t chunk_face_links(uint8_t *blocks)
+{
+    uint64_t visited[BLOCKS_IN_CHUNK / 64] = {};
+    uint16_t stack[BLOCKS_IN_CHUNK];
+    uint64_t links = 0;
+    for (int start = 0; (start < BLOCKS_IN_CHUNK) && (links != FACE_LINKS_ALL); start++)
+    {
+        if ((blocks[start] != BLOCK_AIR) || (visited[start >> 6] & (1ull << (start & 63))))
+        {
+            continue;
+        }
+
+        int faces = 0;
+        int nstack = 0;
+        stack[nstack++] = (uint16_t)start;
+        visited[start >> 6] |= 1ull << (start & 63);
+        while (nstack)
+        {
+            int idx = stack[--nstack];
+            int p[3] = { idx & (CHUNK_DIM - 1), idx >> (2 * CHUNK_DIM_LOG2), (idx >> CHUNK_DIM_LOG2) & (CHUNK_DIM - 1) };
+            for (int f = 0; f < FACE_COUNT; f++)
+            {
+                int q[3] = { p[0] + Face_normals[f][0], p[1] + Face_normals[f][1], p[2] + Face_normals[f][2] };
+                if ((q[0] < 0) || (q[0] >= CHUNK_DIM) || (q[1] < 0) || (q[1] >= CHUNK_DIM) || (q[2] < 0) || (q[2] >= CHUNK_DIM))
+                {
+                    faces |= 1 << f;
+                    continue;
+                }
+
+                int n = CHUNK_DIM * CHUNK_DIM * q[1] + CHUNK_DIM * q[2] + q[0];
+                if ((blocks[n] == BLOCK_AIR) && !(visited[n >> 6] & (1ull << (n & 63))))
+                {
+                    visited[n >> 6] |= 1ull << (n & 63);
+                    stack[nstack++] = (uint16_t)n;
+                }
+            }
+        }
+
+        for (int a = 0; a < FACE_COUNT; a++)
+        {
+            if (faces & (1 << a))
+            {
+                links |= (uint64_t)faces << (FACE_COUNT * a);
+            }
+        }
+    }
+
+    return (links);
+}
+
+// NOTE(max): terrain is a fractal value noise heightmap (grass, then dirt, then stone, snow on high ground) with
+// caves carved where fractal 3D value noise is above TERRAIN_CAVE_THRESHOLD. Everything depends only on the seed
+// and the block coordinates, so a chunk always comes out the same no matter when or on which thread it is made.
+#define DEFAULT_TERRAIN_SEED 1337u
+#define TERRAIN_BASE_HEIGHT 12.0f
+#define TERRAIN_HEIGHT_AMPLITUDE 32.0f
+#define TERRAIN_FREQUENCY (1.0f / 128.0f)
+#define TERRAIN_OCTAVES 5
+#define TERRAIN_DIRT_DEPTH 4
+#define TERRAIN_SNOW_HEIGHT 30
+#define TERRAIN_CAVE_FREQUENCY (1.0f / 24.0f)
+#define TERRAIN_CAVE_OCTAVES 2
+#define TERRAIN_CAVE_THRESHOLD 0.3f
+#define NOISE_LACUNARITY 2.0f
+#define NOISE_GAIN 0.5f
+
+#define NOISE_PRIME_X 501125321u
+#define NOISE_PRIME_Y 1136930381u
+#define NOISE_PRIME_Z 1720413743u
+#define NOISE_HASH_MUL 0x27D4EB2Du
+
+// NOTE(max): scalar noise, the reference for the SSE2 versions below which compute exactly the same thing
+// for 4 samples at once
+inline float noise_lattice(uint32_t seed, uint32_t x_primed, uint32_t y_primed, uint32_t z_primed)
+{
+    uint32_t h = (seed ^ x_primed ^ y_primed ^ z_primed) * NOISE_HASH_MUL;
+    h ^= h >> 15;
+    return ((float)(int32_t)h * (1.0f / 2147483648.0f));
+}
+
+inline float noise_smooth(float t)
+{
+    return ((t * t) * (3.0f - 2.0f * t));
+}
+
+float value_noise_2d(uint32_t seed, float x, float z)
+{
+    float x0 = floorf(x);
+    float z0 = floorf(z);
+    float sx = noise_smooth(x - x0);
+    float sz = noise_smooth(z - z0);
+    uint32_t xp = (uint32_t)(int32_t)x0 * NOISE_PRIME_X;
+    uint32_t zp = (uint32_t)(int32_t)z0 * NOISE_PRIME_Z;
+
+    float v00 = noise_lattice(seed, xp, 0, zp);
+    float v10 = noise_lattice(seed, xp + NOISE_PRIME_X, 0, zp);
+    float v01 = noise_lattice(seed, xp, 0, zp + NOISE_PRIME_Z);
+    float v11 = noise_lattice(seed, xp + NOISE_PRIME_X, 0, zp + NOISE_PRIME_Z);
+
+    float a = v00 + sx * (v10 - v00);
+    float b = v01 + sx * (v11 - v01);
+    return (a + sz * (b - a));
+}
+
+float value_noise_3d(uint32_t seed, float x, float y, float z)
+{
+    float x0 = floorf(x);
+    float y0 = floorf(y);
+    float z0 = floorf(z);
+    float sx = noise_smooth(x - x0);
+    float sy = noise_smooth(y - y0);
+    float sz = noise_smooth(z - z0);
+    uint32_t xp = (uint32_t)(int32_t)x0 * NOISE_PRIME_X;
+    uint32_t yp = (uint32_t)(int32_t)y0 * NOISE_PRIME_Y;
+    uint32_t zp = (uint32_t)(int32_t)z0 * NOISE_PRIME_Z;
+    uint32_t xp1 = xp + NOISE_PRIME_X;
+    uint32_t yp1 = yp + NOISE_PRIME_Y;
+    uint32_t zp1 = zp + NOISE_PRIME_Z;
+
+    float v000 = noise_lattice(seed, xp, yp, zp);
+    float v100 = noise_lattice(seed, xp1, yp, zp);
+    float v010 = noise_lattice(seed, xp, yp1, zp);
+    float v110 = noise_lattice(seed, xp1, yp1, zp);
+    float v001 = noise_lattice(seed, xp, yp, zp1);
+    float v101 = noise_lattice(seed, xp1, yp, zp1);
+    float v011 = noise_lattice(seed, xp, yp1, zp1);
+    float v111 = noise_lattice(seed, xp1, yp1, zp1);
+
+    float a0 = v000 + sx * (v100 - v000);
+    float b0 = v010 + sx * (v110 - v010);
+    float a1 = v001 + sx * (v101 - v001);
+    float b1 = v011 + sx * (v111 - v011);
+    float c0 = a0 + sy * (b0 - a0);
+    float c1 = a1 + sy * (b1 - a1);
+    return (c0 + sz * (c1 - c0));
+}
+
+// NOTE(max): every octave has its own seed, the sum is scaled back to -1..1
+float fractal_noise_2d(uint32_t seed, float x, float z, int octaves)
+{
+    float sum = 0.0f;
+    float amplitude = 1.0f;
+    float total_amplitude = 0.0f;
+    for (int o = 0; o < octaves; o++)
+    {
+        sum += amplitude * value_noise_2d(seed + o, x, z);
+        total_amplitude += amplitude;
+        amplitude *= NOISE_GAIN;
+        x *= NOISE_LACUNARITY;
+        z *= NOISE_LACUNARITY;
+    }
+    return (sum * (1.0f / total_amplitude));
+}
+
+float fractal_noise_3d(uint32_t seed, float x, float y, float z, int octaves)
+{
+    float sum = 0.0f;
+    float amplitude = 1.0f;
+    float total_amplitude = 0.0f;
+    for (int o = 0; o < octaves; o++)
+    {
+        sum += amplitude * value_noise_3d(seed + o, x, y, z);
+        total_amplitude += amplitude;
+        amplitude *= NOISE_GAIN;
+        x *= NOISE_LACUNARITY;
+        y *= NOISE_LACUNARITY;
+        z *= NOISE_LACUNARITY;
+    }
+    return (sum * (1.0f / total_amplitude));
+}
+
+inline __m128 simd_lerp(__m128 a, __m128 b, __m128 t)
+{
+    return (_mm_add_ps(a, _mm_mul_ps(t, _mm_sub_ps(b, a))));
+}
+
+inline __m128 noise_lattice_x4(__m128i seed, __m128i x_primed, __m128i y_primed, __m128i z_primed)
+{
+    __m128i h = _mm_xor_si128(_mm_xor_si128(seed, x_primed), _mm_xor_si128(y_primed, z_primed));
+    h = simd_mullo_epi32(h, _mm_set1_epi32((int)NOISE_HASH_MUL));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+    return (_mm_mul_ps(_mm_cvtepi32_ps(h), _mm_set1_ps(1.0f / 2147483648.0f)));
+}
+
+inline __m128 noise_smooth_x4(__m128 t)
+{
+    return (_mm_mul_ps(_mm_mul_ps(t, t), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_set1_ps(2.0f), t))));
+}
+
+__m128 value_noise_2d_x4(__m128i seed, __m128 x, __m128 z)
+{
+    __m128 x0 = simd_floor(x);
+    __m128 z0 = simd_floor(z);
+    __m128 sx = noise_smooth_x4(_mm_sub_ps(x, x0));
+    __m128 sz = noise_smooth_x4(_mm_sub_ps(z, z0));
+    __m128i prime_x = _mm_set1_epi32((int)NOISE_PRIME_X);
+    __m128i prime_z = _mm_set1_epi32((int)NOISE_PRIME_Z);
+    __m128i xp = simd_mullo_epi32(_mm_cvttps_epi32(x0), prime_x);
+    __m128i zp = simd_mullo_epi32(_mm_cvttps_epi32(z0), prime_z);
+    __m128i xp1 = _mm_add_epi32(xp, prime_x);
+    __m128i zp1 = _mm_add_epi32(zp, prime_z);
+    __m128i zero = _mm_setzero_si128();
+
+    __m128 v00 = noise_lattice_x4(seed, xp, zero, zp);
+    __m128 v10 = noise_lattice_x4(seed, xp1, zero, zp);
+    __m128 v01 = noise_lattice_x4(seed, xp, zero, zp1);
+    __m128 v11 = noise_lattice_x4(seed, xp1, zero, zp1);
+
+    return (simd_lerp(simd_lerp(v00, v10, sx), simd_lerp(v01, v11, sx), sz));
+}
+
+__m128 value_noise_3d_x4(__m128i seed, __m128 x, __m128 y, __m128 z)
+{
+    __m128 x0 = simd_floor(x);
+    __m128 y0 = simd_floor(y);
+    __m128 z0 = simd_floor(z);
+    __m128 sx = noise_smooth_x4(_mm_sub_ps(x, x0));
+    __m128 sy = noise_smooth_x4(_mm_sub_ps(y, y0));
+    __m128 sz = noise_smooth_x4(_mm_sub_ps(z, z0));
+    __m128i prime_x = _mm_set1_epi32((int)NOISE_PRIME_X);
+    __m128i prime_y = _mm_set1_epi32((int)NOISE_PRIME_Y);
+    __m128i prime_z = _mm_set1_epi32((int)NOISE_PRIME_Z);
+    __m128i xp = simd_mullo_epi32(_mm_cvttps_epi32(x0), prime_x);
+    __m128i yp = simd_mullo_epi32(_mm_cvttps_epi32(y0), prime_y);
+    __m128i zp = simd_mullo_epi32(_mm_cvttps_epi32(z0), prime_z);
+    __m128i xp1 = _mm_add_epi32(xp, prime_x);
+    __m128i yp1 = _mm_add_epi32(yp, prime_y);
+    __m128i zp1 = _mm_add_epi32(zp, prime_z);
+
+    __m128 v000 = noise_lattice_x4(seed, xp, yp, zp);
+    __m128 v100 = noise_lattice_x4(seed, xp1, yp, zp);
+    __m128 v010 = noise_lattice_x4(seed, xp, yp1, zp);
+    __m128 v110 = noise_lattice_x4(seed, xp1, yp1, zp);
+    __m128 v001 = noise_lattice_x4(seed, xp, yp, zp1);
+    __m128 v101 = noise_lattice_x4(seed, xp1, yp, zp1);
+    __m128 v011 = noise_lattice_x4(seed, xp, yp1, zp1);
+    __m128 v111 = noise_lattice_x4(seed, xp1, yp1, zp1);
+
+    __m128 c0 = simd_lerp(simd_lerp(v000, v100, sx), simd_lerp(v010, v110, sx), sy);
+    __m128 c1 = simd_lerp(simd_lerp(v001, v101, sx), simd_lerp(v011, v111, sx), sy);
+    return (simd_lerp(c0, c1, sz));
+}
+
+__m128 fractal_noise_2d_x4(uint32_t seed, __m128 x, __m128 z, int octaves)
+{
+    __m128 sum = _mm_setzero_ps();
+    float amplitude = 1.0f;
+    float total_amplitude = 0.0f;
+    __m128 lacunarity = _mm_set1_ps(NOISE_LACUNARITY);
+    for (int o = 0; o < octaves; o++)
+    {
+        __m128 n = value_noise_2d_x4(_mm_set1_epi32((int)(seed + o)), x, z);
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amplitude), n));
+        total_amplitude += amplitude;
+        amplitude *= NOISE_GAIN;
+        x = _mm_mul_ps(x, lacunarity);
+        z = _mm_mul_ps(z, lacunarity);
+    }
+    return (_mm_mul_ps(sum, _mm_set1_ps(1.0f / total_amplitude)));
+}
+
+__m128 fractal_noise_3d_x4(uint32_t seed, __m128 x, __m128 y, __m128 z, int octaves)
+{
+    __m128 sum = _mm_setzero_ps();
+    float amplitude = 1.0f;
+    float total_amplitude = 0.0f;
+    __m128 lacunarity = _mm_set1_ps(NOISE_LACUNARITY);
+    for (int o = 0; o < octaves; o++)
+    {
+        __m128 n = value_noise_3d_x4(_mm_set1_epi32((int)(seed + o)), x, y, z);
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amplitude), n));
+        total_amplitude += amplitude;
+        amplitude *= NOISE_GAIN;
+        x = _mm_mul_ps(x, lacunarity);
+        y = _mm_mul_ps(y, lacunarity);
+        z = _mm_mul_ps(z, lacunarity);
+    }
+    return (_mm_mul_ps(sum, _mm_set1_ps(1.0f / total_amplitude)));
+}
+
+// NOTE(max): the caves use a different noise than the heightmap
+inline uint32_t terrain_cave_seed(uint32_t seed)
+{
+    return (seed * NOISE_HASH_MUL + 0x9E3779B9u);
+}
+
+// NOTE(max): y of the top solid block of the column, the scalar version is used to place the camera
+int terrain_height(uint32_t seed, int x, int z)
+{
+    float n = fractal_noise_2d(seed, (float)x * TERRAIN_FREQUENCY, (float)z * TERRAIN_FREQUENCY, TERRAIN_OCTAVES);
+    return ((int)floorf(TERRAIN_BASE_HEIGHT + n * TERRAIN_HEIGHT_AMPLITUDE));
+}
+
+// NOTE(max): heights[CHUNK_DIM * z + x] for the columns of the chunk, 4 columns at a time
+void terrain_heights(uint32_t seed, int chunk_x, int chunk_z, int *heights)
+{
+    __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 frequency = _mm_set1_ps(TERRAIN_FREQUENCY);
+    for (int z = 0; z < CHUNK_DIM; z++)
+    {
+        __m128 wz = _mm_set1_ps((float)(chunk_z * CHUNK_DIM + z) * TERRAIN_FREQUENCY);
+        for (int x = 0; x < CHUNK_DIM; x += 4)
+        {
+            __m128 wx = _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)(chunk_x * CHUNK_DIM + x)), lane), frequency);
+            __m128 n = fractal_noise_2d_x4(seed, wx, wz, TERRAIN_OCTAVES);
+            __m128 h = _mm_add_ps(_mm_set1_ps(TERRAIN_BASE_HEIGHT), _mm_mul_ps(n, _mm_set1_ps(TERRAIN_HEIGHT_AMPLITUDE)));
+            _mm_storeu_si128((__m128i *)&heights[CHUNK_DIM * z + x], _mm_cvttps_epi32(simd_floor(h)));
+        }
+    }
+}
+
+void generate_chunk(uint32_t seed, int chunk_x, int chunk_y, int chunk_z, uint8_t *blocks)
+{
+    int heights[CHUNK_DIM * CHUNK_DIM];
+    terrain_heights(seed, chunk_x, chunk_z, heights);
+
+    int max_height = heights[0];
+    for (int i = 1; i < CHUNK_DIM * CHUNK_DIM; i++)
+    {
+        max_height = std::max(max_height, heights[i]);
+    }
+
+    memset(blocks, BLOCK_AIR, BLOCKS_IN_CHUNK);
+    int base_y = chunk_y * CHUNK_DIM;
+    if (base_y > max_height)
+    {
+        return;
+    }
+
+    for (int z = 0; z < CHUNK_DIM; z++)
+    {
+        for (int x = 0; x < CHUNK_DIM; x++)
+        {
+            int height = heights[CHUNK_DIM * z + x];
+            int top = std::min(height - base_y, CHUNK_DIM - 1);
+            for (int y = 0; y <= top; y++)
+            {
+                int world_y = base_y + y;
+                uint8_t type;
+                if (world_y == height)
+                    type = (height >= TERRAIN_SNOW_HEIGHT) ? BLOCK_SNOW : BLOCK_GRASS;
+                else if (world_y > height - TERRAIN_DIRT_DEPTH)
+                    type = BLOCK_DIRT;
+                else
+                    type = BLOCK_STONE;
+
+                blocks[CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x] = type;
+            }
+        }
+    }
+
+    uint32_t cave_seed = terrain_cave_seed(seed);
+    __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 frequency = _mm_set1_ps(TERRAIN_CAVE_FREQUENCY);
+    __m128 threshold = _mm_set1_ps(TERRAIN_CAVE_THRESHOLD);
+    for (int y = 0; y < CHUNK_DIM; y++)
+    {
+        __m128 wy = _mm_set1_ps((float)(base_y + y) * TERRAIN_CAVE_FREQUENCY);
+        for (int z = 0; z < CHUNK_DIM; z++)
+        {
+            __m128 wz = _mm_set1_ps((float)(chunk_z * CHUNK_DIM + z) * TERRAIN_CAVE_FREQUENCY);
+            uint8_t *row = &blocks[CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z];
+            for (int x = 0; x < CHUNK_DIM; x += 4)
+            {
+                // NOTE(max): nothing to carve above the surface
+                if ((row[x] == BLOCK_AIR) && (row[x + 1] == BLOCK_AIR) && (row[x + 2] == BLOCK_AIR) && (row[x + 3] == BLOCK_AIR))
+                {
+                    continue;
+                }
+
+                __m128 wx = _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)(chunk_x * CHUNK_DIM + x)), lane), frequency);
+                __m128 n = fractal_noise_3d_x4(cave_seed, wx, wy, wz, TERRAIN_CAVE_OCTAVES);
+                int carve = _mm_movemask_ps(_mm_cmpgt_ps(n, threshold));
+                for (int i = 0; i < 4; i++)
+                {
+                    if (carve & (1 << i))
+                    {
+                        row[x + i] = BLOCK_AIR;
+                    }
+                }
+            }
+        }
+    }
+}
+
+bool light_init(Light_engine *engine, World *world, Memory_arena *arena, uint32_t seed)
+{
+    engine->world = world;
+    engine->arena = arena;
+    engine->seed = seed;
+    engine->add.nodes = (Light_node *)memory_arena_alloc(arena, LIGHT_QUEUE_SIZE * sizeof(Light_node));
+    engine->remove.nodes = (Light_node *)memory_arena_alloc(arena, LIGHT_QUEUE_SIZE * sizeof(Light_node));
+    engine->add.head = engine->add.count = 0;
+    engine->remove.head = engine->remove.count = 0;
+    engine->stats = {};
+    return (engine->add.nodes && engine->remove.nodes);
+}
+
+inline void light_push(Light_engine *engine, Light_queue *q, Chunk *c, int idx, int value, int channel)
+{
+    if (q->count == LIGHT_QUEUE_SIZE)
+    {
+        engine->stats.dropped++;
+        return;
+    }
+
+    Light_node *node = &q->nodes[(q->head + q->count++) & (LIGHT_QUEUE_SIZE - 1)];
+    node->c = c;
+    node->idx = (uint16_t)idx;
+    node->value = (uint8_t)value;
+    node->channel = (uint8_t)channel;
+}
+
+inline Light_node light_pop(Light_queue *q)
+{
+    assert(q->count > 0);
+    Light_node node = q->nodes[q->head];
+    q->head = (q->head + 1) & (LIGHT_QUEUE_SIZE - 1);
+    q->count--;
+    return (node);
+}
+
+// NOTE(max): block next to block idx of c across face, 0 if its chunk is not loaded or not generated yet
+inline Chunk *light_step(Chunk *c, int idx, int face, int *out_idx)
+{
+    int x = (idx & (CHUNK_DIM - 1)) + Face_normals[face][0];
+    int y = (idx >> (2 * CHUNK_DIM_LOG2)) + Face_normals[face][1];
+    int z = ((idx >> CHUNK_DIM_LOG2) & (CHUNK_DIM - 1)) + Face_normals[face][2];
+    if ((x < 0) || (x >= CHUNK_DIM) || (y < 0) || (y >= CHUNK_DIM) || (z < 0) || (z >= CHUNK_DIM))
+    {
+        c = c->neighbours[face];
+        x &= CHUNK_DIM - 1;
+        y &= CHUNK_DIM - 1;
+        z &= CHUNK_DIM - 1;
+    }
+    *out_idx = CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x;
+    return ((c && c->generated) ? c : 0);
+}
+
+// NOTE(max): faces next to the block read its light, so its chunk and the neighbours it touches are remeshed
+void light_set(Light_engine *engine, Chunk *c, int idx, uint8_t light)
+{
+    if (!chunk_set_light_idx(&engine->world->block_storage, c, idx, light))
+    {
+        engine->stats.dropped++;
+        return;
+    }
+
+    if (c->nblocks)
+    {
+        world_push_chunk_for_rebuild(engine->world, engine->arena, c);
+    }
+    world_push_neighbours_for_rebuild(engine->world, engine->arena, c, idx & (CHUNK_DIM - 1),
+                                      idx >> (2 * CHUNK_DIM_LOG2), (idx >> CHUNK_DIM_LOG2) & (CHUNK_DIM - 1));
+}
+
+// NOTE(max): sky light a block at the top of the column x, z of c gets from above. The chunk above decides when it
+// is there, otherwise the terrain height does, which ignores edits and caves in chunks that are not loaded.
+inline bool light_column_open(Chunk *c, int x, int z, int height)
+{
+    Chunk *above = c->neighbours[FACE_TOP];
+    if (above && above->generated)
+    {
+        return ((chunk_get_light_idx(above, CHUNK_DIM * z + x) >> LIGHT_SKY_SHIFT) == LIGHT_MAX);
+    }
+    return ((c->y + 1) * CHUNK_DIM > height);
+}
+
+// NOTE(max): every node spreads both channels into the air blocks around it
+void light_run_add(Light_engine *engine)
+{
+    while (engine->add.count)
+    {
+        Light_node node = light_pop(&engine->add);
+        engine->stats.nodes_added++;
+
+        uint8_t light = chunk_get_light_idx(node.c, node.idx);
+        int sky = light >> LIGHT_SKY_SHIFT;
+        int block = light & LIGHT_MAX;
+        for (int f = 0; f < FACE_COUNT; f++)
+        {
+            int n_idx;
+            Chunk *n = light_step(node.c, node.idx, f, &n_idx);
+            if (!n || (chunk_get_block_idx(n, n_idx) != BLOCK_AIR))
+            {
+                continue;
+            }
+
+            int n_sky_in = ((f == FACE_BOTTOM) && (sky == LIGHT_MAX)) ? LIGHT_MAX : (sky - 1);
+            uint8_t n_light = chunk_get_light_idx(n, n_idx);
+            int n_sky = std::max(n_light >> LIGHT_SKY_SHIFT, n_sky_in);
+            int n_block = std::max(n_light & LIGHT_MAX, block - 1);
+            uint8_t new_light = (uint8_t)((n_sky << LIGHT_SKY_SHIFT) | n_block);
+            if (new_light != n_light)
+            {
+                light_set(engine, n, n_idx, new_light);
+                light_push(engine, &engine->add, n, n_idx, 0, 0);
+            }
+        }
+    }
+}
+
+// NOTE(max): clears the blocks the removed light reached, which is every block in channel that had less light than
+// the block it was reached from (or full sky straight down from full sky). Blocks with more light and emitters next
+// to the cleared ones are lit from elsewhere, they go to the add queue to fill the hole back in.
+void light_run_remove(Light_engine *engine)
+{
+    while (engine->remove.count)
+    {
+        Light_node node = light_pop(&engine->remove);
+        engine->stats.nodes_removed++;
+
+        int shift = (node.channel == LIGHT_CHANNEL_SKY) ? LIGHT_SKY_SHIFT : 0;
+        for (int f = 0; f < FACE_COUNT; f++)
+        {
+            int n_idx;
+            Chunk *n = light_step(node.c, node.idx, f, &n_idx);
+            if (!n)
+            {
+                continue;
+            }
+
+            uint8_t n_light = chunk_get_light_idx(n, n_idx);
+            int value = (n_light >> shift) & LIGHT_MAX;
+            if (value == 0)
+            {
+                continue;
+            }
+
+            bool sky_column = (node.channel == LIGHT_CHANNEL_SKY) && (f == FACE_BOTTOM) && (node.value == LIGHT_MAX);
+            if ((chunk_get_block_idx(n, n_idx) == BLOCK_AIR) && ((value < node.value) || sky_column))
+            {
+                light_set(engine, n, n_idx, (uint8_t)(n_light & ~(LIGHT_MAX << shift)));
+                light_push(engine, &engine->remove, n, n_idx, value, node.channel);
+            }
+            else
+            {
+                light_push(engine, &engine->add, n, n_idx, 0, 0);
+            }
+        }
+    }
+}
+
+// NOTE(max): lights a chunk that just got its blocks. Sky light goes straight down the open columns, lamps are
+// lit, then the fill spreads both from the new chunk and from the borders of the loaded chunks around it. Full sky
+// that the chunk below got from the terrain height but that the new chunk blocks is removed.
+void light_chunk_init(Light_engine *engine, Chunk *c)
+{
+    double start = glfwGetTime();
+    engine->stats.chunks_lit++;
+
+    uint8_t blocks[BLOCKS_IN_CHUNK];
+    uint8_t light[BLOCKS_IN_CHUNK];
+    chunk_copy_blocks(c, blocks);
+    memset(light, 0, BLOCKS_IN_CHUNK);
+
+    int heights[CHUNK_DIM * CHUNK_DIM] = {};
+    Chunk *above = c->neighbours[FACE_TOP];
+    if (!above || !above->generated)
+    {
+        terrain_heights(engine->seed, c->x, c->z, heights);
+    }
+
+    for (int z = 0; z < CHUNK_DIM; z++)
+    {
+        for (int x = 0; x < CHUNK_DIM; x++)
+        {
+            if (!light_column_open(c, x, z, heights[CHUNK_DIM * z + x]))
+            {
+                continue;
+            }
+            for (int y = CHUNK_DIM - 1; y >= 0; y--)
+            {
+                int idx = CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x;
+                if (blocks[idx] != BLOCK_AIR)
+                {
+                    break;
+                }
+                light[idx] = LIGHT_MAX << LIGHT_SKY_SHIFT;
+            }
+        }
+    }
+
+    if (c->nblocks)
+    {
+        for (int i = 0; i < BLOCKS_IN_CHUNK; i++)
+        {
+            light[i] |= Block_light_emission[blocks[i]];
+        }
+    }
+
+    if (!chunk_set_all_light(&engine->world->block_storage, c, light))
+    {
+        engine->stats.dropped++;
+        chunk_fill_light(&engine->world->block_storage, c, 0);
+        return;
+    }
+
+    // NOTE(max): inside the chunk only full sky next to darker air and emitters have anything to spread, the
+    // border blocks spread into the neighbours
+    for (int y = 0; y < CHUNK_DIM; y++)
+    {
+        for (int z = 0; z < CHUNK_DIM; z++)
+        {
+            for (int x = 0; x < CHUNK_DIM; x++)
+            {
+                int idx = CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x;
+                if (!light[idx])
+                {
+                    continue;
+                }
+
+                bool push = (light[idx] & LIGHT_MAX) || (x == 0) || (x == CHUNK_DIM - 1) || (y == 0) ||
+                            (y == CHUNK_DIM - 1) || (z == 0) || (z == CHUNK_DIM - 1);
+                // NOTE(max): the faces after FACE_TOP are the lateral ones
+                for (int f = FACE_TOP + 1; !push && (f < FACE_COUNT); f++)
+                {
+                    int n_idx = idx + CHUNK_DIM * CHUNK_DIM * Face_normals[f][1] + CHUNK_DIM * Face_normals[f][2] +
+                                Face_normals[f][0];
+                    push = (blocks[n_idx] == BLOCK_AIR) && (light[n_idx] < light[idx]);
+                }
+                if (push)
+                {
+                    light_push(engine, &engine->add, c, idx, 0, 0);
+                }
+            }
+        }
+    }
+
+    for (int f = 0; f < FACE_COUNT; f++)
+    {
+        Chunk *n = c->neighbours[f];
+        if (!n || !n->generated)
+        {
+            continue;
+        }
+
+        // NOTE(max): the layer of n that touches c
+        int a = (Face_normals[f][0] != 0) ? 0 : ((Face_normals[f][1] != 0) ? 1 : 2);
+        int layer = (Face_normals[f][a] > 0) ? 0 : (CHUNK_DIM - 1);
+        for (int v = 0; v < CHUNK_DIM; v++)
+        {
+            for (int u = 0; u < CHUNK_DIM; u++)
+            {
+                int p[3];
+                p[a] = layer;
+                p[(a + 1) % 3] = u;
+                p[(a + 2) % 3] = v;
+                int n_idx = CHUNK_DIM * CHUNK_DIM * p[1] + CHUNK_DIM * p[2] + p[0];
+                uint8_t n_light = chunk_get_light_idx(n, n_idx);
+                if (!n_light)
+                {
+                    continue;
+                }
+
+                int idx = n_idx + (CHUNK_DIM - 1 - 2 * layer) * ((a == 0) ? 1 : ((a == 1) ? CHUNK_DIM * CHUNK_DIM : CHUNK_DIM));
+                if ((f == FACE_BOTTOM) && ((n_light >> LIGHT_SKY_SHIFT) == LIGHT_MAX) &&
+                    ((light[idx] >> LIGHT_SKY_SHIFT) != LIGHT_MAX) && (chunk_get_block_idx(n, n_idx) == BLOCK_AIR))
+                {
+                    light_set(engine, n, n_idx, (uint8_t)(n_light & LIGHT_MAX));
+                    light_push(engine, &engine->remove, n, n_idx, LIGHT_MAX, LIGHT_CHANNEL_SKY);
+                }
+                else
+                {
+                    light_push(engine, &engine->add, n, n_idx, 0, 0);
+                }
+            }
+        }
+    }
+
+    light_run_remove(engine);
+    light_run_add(engine);
+
+    engine->stats.time_us += (glfwGetTime() - start) * 1e6;
+}
+
+// NOTE(max): call after the block at x, y, z of c was set, old_type is what was there before
+void light_block_changed(Light_engine *engine, Chunk *c, int x, int y, int z, uint8_t old_type)
+{
+    int idx = CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x;
+    uint8_t type = chunk_get_block_idx(c, idx);
+    if (type == old_type)
+    {
+        return;
+    }
+
+    double start = glfwGetTime();
+    engine->stats.edits++;
+    uint8_t old_light = chunk_get_light_idx(c, idx);
+
+    light_set(engine, c, idx, 0);
+    if (old_light >> LIGHT_SKY_SHIFT)
+    {
+        light_push(engine, &engine->remove, c, idx, old_light >> LIGHT_SKY_SHIFT, LIGHT_CHANNEL_SKY);
+    }
+    if (old_light & LIGHT_MAX)
+    {
+        light_push(engine, &engine->remove, c, idx, old_light & LIGHT_MAX, LIGHT_CHANNEL_BLOCK);
+    }
+    light_run_remove(engine);
+
+    if (type != BLOCK_AIR)
+    {
+        if (Block_light_emission[type])
+        {
+            light_set(engine, c, idx, Block_light_emission[type]);
+            light_push(engine, &engine->add, c, idx, 0, 0);
+        }
+    }
+    else
+    {
+        // NOTE(max): the new air block is lit by the blocks around it
+        for (int f = 0; f < FACE_COUNT; f++)
+        {
+            int n_idx;
+            Chunk *n = light_step(c, idx, f, &n_idx);
+            if (n && chunk_get_light_idx(n, n_idx))
+            {
+                light_push(engine, &engine->add, n, n_idx, 0, 0);
+            }
+        }
+
+        Chunk *above = c->neighbours[FACE_TOP];
+        if ((y == CHUNK_DIM - 1) && (!above || !above->generated) &&
+            light_column_open(c, x, z, terrain_height(engine->seed, c->x * CHUNK_DIM + x, c->z * CHUNK_DIM + z)))
+        {
+            light_set(engine, c, idx, LIGHT_MAX << LIGHT_SKY_SHIFT);
+            light_push(engine, &engine->add, c, idx, 0, 0);
+        }
+    }
+    light_run_add(engine);
+
+    engine->stats.time_us += (glfwGetTime() - start) * 1e6;
+}
+
+// NOTE(max): times world_find_chunk on worlds of growing size, the cost per lookup should stay flat. The chunks
+// are 4 high, the lookups go 8 high over the same columns so about half of them miss.
+void index_benchmark(uint32_t seed)
+{
+    const int sizes[] = {49, 1000, 10000, 40000};
+    const int nsizes = sizeof(sizes) / sizeof(sizes[0]);
+    const int nlookups = 1 << 20;
+    const int max_chunks = sizes[nsizes - 1];
+    size_t arena_size = (size_t)max_chunks * (sizeof(Chunk) + 8 * sizeof(Chunk_index_slot)) + (64ull << 20);
+    uint8_t *arena_memory = (uint8_t *)malloc(arena_size);
+    World *world = (World *)malloc(sizeof(World));
+    int *lookups = (int *)malloc(3 * nlookups * sizeof(int));
+    if (!arena_memory || !world || !lookups)
+    {
+        free(lookups);
+        free(world);
+        free(arena_memory);
+        return;
+    }
+
+    for (int s = 0; s < nsizes; s++)
+    {
+        int nchunks = sizes[s];
+        int side = (int)ceilf(sqrtf(nchunks / 4.0f));
+        Memory_arena arena;
+        memory_arena_init(&arena, arena_memory, arena_size);
+        bool ok = world_init(world, &arena);
+        for (int i = 0; ok && (i < nchunks); i++)
+        {
+            ok = world_add_chunk(world, &arena, i % side, (i / side) % 4, i / (4 * side)) != 0;
+        }
+        if (!ok)
+        {
+            printf("index: could not add %d chunks\n", nchunks);
+            break;
+        }
+
+        uint32_t rng = seed | 1;
+        for (int i = 0; i < 3 * nlookups; i += 3)
+        {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            lookups[i + 0] = (int)((rng & 0xFFFF) % side);
+            lookups[i + 1] = (int)((rng >> 16) & 7);
+            lookups[i + 2] = (int)((rng >> 19) % side);
+        }
+
+        int nfound = 0;
+        double start = glfwGetTime();
+        for (int i = 0; i < 3 * nlookups; i += 3)
+        {
+            nfound += (world_find_chunk(world, lookups[i + 0], lookups[i + 1], lookups[i + 2]) != 0);
+        }
+        double lookup_s = glfwGetTime() - start;
+
+        printf("index: %5d chunks, index capacity %6d, %.1f ns/lookup, %.1f%% found\n", nchunks, world->index_capacity,
+            lookup_s * 1e9 / nlookups, 100.0 * nfound / nlookups);
+    }
+
+    free(lookups);
+    free(world);
+    free(arena_memory);
+}
+
+enum Mesher_bench_chunks
+{
+    MESHER_BENCH_CHECKERBOARD,
+    MESHER_BENCH_RANDOM,
+    MESHER_BENCH_TERRAIN,
+
+    MESHER_BENCH_CHUNKS_COUNT,
+};
+
+// NOTE(max): blocks of one chunk of the benchmark worlds, the checkerboard and random blocks depend on the world
+// coordinates only so neighbour chunks line up
+void mesher_bench_fill(int chunks, uint32_t seed, int chunk_x, int chunk_y, int chunk_z, uint8_t *blocks)
+{
+    if (chunks == MESHER_BENCH_TERRAIN)
+    {
+        generate_chunk(seed, chunk_x, chunk_y, chunk_z, blocks);
+        return;
+    }
+
+    for (int y = 0; y < CHUNK_DIM; y++)
+    {
+        for (int z = 0; z < CHUNK_DIM; z++)
+        {
+            for (int x = 0; x < CHUNK_DIM; x++)
+            {
+                int gx = chunk_x * CHUNK_DIM + x;
+                int gy = chunk_y * CHUNK_DIM + y;
+                int gz = chunk_z * CHUNK_DIM + z;
+                uint8_t type;
+                if (chunks == MESHER_BENCH_CHECKERBOARD)
+                {
+                    type = ((gx + gy + gz) & 1) ? (uint8_t)BLOCK_AIR : (uint8_t)((unsigned)(gx + 3 * gz) % BLOCK_TYPE_COUNT);
+                }
+                else
+                {
+                    uint32_t h = seed ^ ((uint32_t)gx * 73856093u) ^ ((uint32_t)gy * 19349663u) ^ ((uint32_t)gz * 83492791u);
+                    h ^= h << 13;
+                    h ^= h >> 17;
+                    h ^= h << 5;
+                    // NOTE(max): half of the blocks are air
+                    int r = (h >> 8) % (2 * BLOCK_TYPE_COUNT);
+                    type = (uint8_t)((r < BLOCK_TYPE_COUNT) ? r : BLOCK_AIR);
+                }
+                blocks[CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x] = type;
+            }
+        }
+    }
+}
+
+// NOTE(max): meshes the same chunks with every mesher, with and without their six neighbours, and prints triangles
+// and us per chunk. Every emitted face is checked against the brute force set of exposed block faces: surface and
+// greedy have to cover each exposed face exactly once with its block type and nothing else, volume has to cover
+// each exposed face once and its buried faces are counted.
+void mesher_benchmark(uint32_t seed)
+{
+    const int nrepeats = 8;
+    const char *chunks_names[MESHER_BENCH_CHUNKS_COUNT] = {"checkerboard", "random", "terrain"};
+    const Mesher_mode modes[] = {MESHER_VOLUME, MESHER_SURFACE, MESHER_GREEDY};
+    const char *mode_names[] = {"volume", "surface", "greedy"};
+    const int nmodes = sizeof(modes) / sizeof(modes[0]);
+    size_t arena_size = 64ull << 20;
+    uint8_t *arena_memory = (uint8_t *)malloc(arena_size);
+    uint8_t *blocks = (uint8_t *)malloc((FACE_COUNT + 1) * BLOCKS_IN_CHUNK);
+    uint8_t *covered = (uint8_t *)malloc(FACE_COUNT * BLOCKS_IN_CHUNK);
+    if (!arena_memory || !blocks || !covered)
+    {
+        free(covered);
+        free(blocks);
+        free(arena_memory);
+        return;
+    }
+
+    Memory_arena arena;
+    memory_arena_init(&arena, arena_memory, arena_size);
+    void *cursor = memory_arena_get_cursor(&arena);
+
+    for (int chunks = 0; chunks < MESHER_BENCH_CHUNKS_COUNT; chunks++)
+    {
+        for (int with_neighbours = 0; with_neighbours < 2; with_neighbours++)
+        {
+            // NOTE(max): 4x4x2 chunks from below to above the terrain surface
+            int nchunks = 0;
+            int64_t ntriangles[nmodes] = {};
+            int nwrong[nmodes] = {};
+            int nburied[nmodes] = {};
+            double mesh_s[nmodes] = {};
+            bool ok = true;
+            for (int i = 0; ok && (i < 32); i++)
+            {
+                int cx = i & 3;
+                int cy = ((i >> 2) & 3) - 1;
+                int cz = i >> 4;
+                Mesher_input in = {};
+                in.blocks = blocks;
+                mesher_bench_fill(chunks, seed, cx, cy, cz, in.blocks);
+                for (int face = 0; with_neighbours && (face < FACE_COUNT); face++)
+                {
+                    in.neighbours[face] = blocks + (face + 1) * BLOCKS_IN_CHUNK;
+                    mesher_bench_fill(chunks, seed, cx + Face_normals[face][0], cy + Face_normals[face][1],
+                        cz + Face_normals[face][2], in.neighbours[face]);
+                }
+                for (int b = 0; b < BLOCKS_IN_CHUNK; b++)
+                {
+                    in.nblocks += (blocks[b] != BLOCK_AIR);
+                }
+                nchunks++;
+
+                for (int m = 0; ok && (m < nmodes); m++)
+                {
+                    Chunk_mesh_data mesh = {};
+                    for (int r = 0; ok && (r < nrepeats); r++)
+                    {
+                        memory_arena_set_cursor(&arena, cursor);
+                        double start = glfwGetTime();
+                        ok = mesh_chunk(&in, modes[m], VERTEX_FORMAT_FLOAT, &arena, &mesh);
+                        mesh_s[m] += glfwGetTime() - start;
+                    }
+                    if (!ok)
+                    {
+                        break;
+                    }
+                    ntriangles[m] += mesh.num_of_vs / 3;
+
+                    memset(covered, 0, FACE_COUNT * BLOCKS_IN_CHUNK);
+                    Float_vertex *vs = (Float_vertex *)mesh.vs;
+                    for (int f = 0; f < mesh.num_of_vs; f += 6)
+                    {
+                        int face = 0;
+                        while ((face < FACE_COUNT) && ((float)Face_normals[face][0] != vs[f].normal.x ||
+                               (float)Face_normals[face][1] != vs[f].normal.y || (float)Face_normals[face][2] != vs[f].normal.z))
+                        {
+                            face++;
+                        }
+                        if (face == FACE_COUNT)
+                        {
+                            nwrong[m]++;
+                            continue;
+                        }
+
+                        // NOTE(max): the face covers the cells [lo, hi) of its plane, the cells are behind the
+                        // plane for faces pointing the positive way
+                        int lo[3] = {(int)vs[f].pos.x, (int)vs[f].pos.y, (int)vs[f].pos.z};
+                        int hi[3] = {lo[0], lo[1], lo[2]};
+                        for (int v = f + 1; v < f + 6; v++)
+                        {
+                            int p[3] = {(int)vs[v].pos.x, (int)vs[v].pos.y, (int)vs[v].pos.z};
+                            for (int k = 0; k < 3; k++)
+                            {
+                                lo[k] = std::min(lo[k], p[k]);
+                                hi[k] = std::max(hi[k], p[k]);
+                            }
+                        }
+                        int a, u, w;
+                        face_axes(face, &a, &u, &w);
+                        lo[a] -= (Face_normals[face][a] > 0);
+                        hi[a] = lo[a] + 1;
+
+                        for (int y = lo[1]; y < hi[1]; y++)
+                        {
+                            for (int z = lo[2]; z < hi[2]; z++)
+                            {
+                                for (int x = lo[0]; x < hi[0]; x++)
+                                {
+                                    if ((x < 0) || (y < 0) || (z < 0) || (x >= CHUNK_DIM) || (y >= CHUNK_DIM) || (z >= CHUNK_DIM))
+                                    {
+                                        nwrong[m]++;
+                                        continue;
+                                    }
+                                    int idx = CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x;
+                                    nwrong[m] += (blocks[idx] == BLOCK_AIR) || (vs[f].type != blocks[idx]);
+                                    covered[face * BLOCKS_IN_CHUNK + idx]++;
+                                }
+                            }
+                        }
+                    }
+
+                    for (int face = 0; face < FACE_COUNT; face++)
+                    {
+                        for (int idx = 0; idx < BLOCKS_IN_CHUNK; idx++)
+                        {
+                            int x = idx % CHUNK_DIM;
+                            int z = (idx / CHUNK_DIM) % CHUNK_DIM;
+                            int y = idx / (CHUNK_DIM * CHUNK_DIM);
+                            bool exposed = (blocks[idx] != BLOCK_AIR) && (mesher_get_block(&in, x + Face_normals[face][0],
+                                y + Face_normals[face][1], z + Face_normals[face][2]) == BLOCK_AIR);
+                            int n = covered[face * BLOCKS_IN_CHUNK + idx];
+                            if ((modes[m] == MESHER_VOLUME) && !exposed && (n == 1))
+                            {
+                                nburied[m]++;
+                            }
+                            else
+                            {
+                                nwrong[m] += (n != (exposed ? 1 : 0));
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (!ok)
+            {
+                printf("mesher: %s: out of memory\n", chunks_names[chunks]);
+                continue;
+            }
+
+            for (int m = 0; m < nmodes; m++)
+            {
+                printf("mesher: %-12s %-13s %-7s %8lld triangles (%5.1f%% of volume) %7.1f us/chunk, %d wrong faces",
+                    chunks_names[chunks], with_neighbours ? "neighbours" : "no neighbours", mode_names[m],
+                    (long long)ntriangles[m], ntriangles[0] ? 100.0 * ntriangles[m] / ntriangles[0] : 0.0,
+                    mesh_s[m] * 1e6 / (nchunks * nrepeats), nwrong[m]);
+                if (modes[m] == MESHER_VOLUME)
+                {
+                    printf(", %d buried faces", nburied[m]);
+                }
+                printf("\n");
+            }
+        }
+    }
+
+    free(covered);
+    free(blocks);
+    free(arena_memory);
+}
+
+// NOTE(max): 4M random chunk_set_block calls on chunks that start empty or with terrain. Every 1024 sets the chunk
+// has to match a plain block array and pass chunk_occupancy_valid, only the sets themselves are timed.
+void occupancy_benchmark(uint32_t seed)
+{
+    const int nrounds = 64;
+    const int nsets = 1 << 16;
+    const int check_every = 1 << 10;
+    size_t arena_size = 64ull << 20;
+    uint8_t *arena_memory = (uint8_t *)malloc(arena_size);
+    World *world = (World *)malloc(sizeof(World));
+    uint8_t *expected = (uint8_t *)malloc(BLOCKS_IN_CHUNK);
+    uint8_t *actual = (uint8_t *)malloc(BLOCKS_IN_CHUNK);
+    Memory_arena arena;
+    Chunk *c = 0;
+    bool ok = arena_memory && world && expected && actual;
+    if (ok)
+    {
+        memory_arena_init(&arena, arena_memory, arena_size);
+        ok = world_init(world, &arena);
+    }
+    if (ok)
+    {
+        c = world_add_chunk(world, &arena, 0, 0, 0);
+        ok = c != 0;
+    }
+
+    uint32_t rng = seed | 1;
+    uint64_t ndone = 0;
+    int nchecks = 0;
+    int nfailed = 0;
+    double set_s = 0.0;
+    for (int round = 0; ok && (round < nrounds); round++)
+    {
+        if (round & 1)
+        {
+            generate_chunk(seed, round, 0, 0, expected);
+        }
+        else
+        {
+            memset(expected, BLOCK_AIR, BLOCKS_IN_CHUNK);
+        }
+        ok = chunk_set_all_blocks(&world->block_storage, c, expected);
+
+        for (int i = 0; ok && (i < nsets); i += check_every)
+        {
+            double start = glfwGetTime();
+            for (int j = 0; ok && (j < check_every); j++)
+            {
+                rng ^= rng << 13;
+                rng ^= rng >> 17;
+                rng ^= rng << 5;
+                int idx = rng & (BLOCKS_IN_CHUNK - 1);
+                // NOTE(max): half of the sets are air so chunks keep switching between sparse and dense
+                int r = (rng >> 12) % (2 * BLOCK_TYPE_COUNT);
+                uint8_t type = (uint8_t)((r < BLOCK_TYPE_COUNT) ? r : BLOCK_AIR);
+                ok = chunk_set_block_idx(&world->block_storage, c, idx, type);
+                expected[idx] = type;
+                ndone++;
+            }
+            set_s += glfwGetTime() - start;
+
+            int nsolid = 0;
+            for (int b = 0; b < BLOCKS_IN_CHUNK; b++)
+            {
+                nsolid += (expected[b] != BLOCK_AIR);
+            }
+            chunk_copy_blocks(c, actual);
+            nfailed += (memcmp(expected, actual, BLOCKS_IN_CHUNK) != 0) || (c->nblocks != nsolid) ||
+                       !chunk_occupancy_valid(c);
+            nchecks++;
+        }
+    }
+
+    if (ok)
+    {
+        printf("occupancy: %llu sets, %.1f ns/set, %d checks, %d out of sync\n", (unsigned long long)ndone,
+            set_s * 1e9 / ndone, nchecks, nfailed);
+    }
+    else
+    {
+        printf("occupancy: out of memory after %llu sets\n", (unsigned long long)ndone);
+    }
+
+    free(actual);
+    free(expected);
+    free(world);
+    free(arena_memory);
+}
+
+// NOTE(max): generates chunks on this thread only and prints chunks per second for one core. The SSE2 noise is
+// checked against the scalar noise over the same samples, the timings of both show what the vectorization buys.
+void terrain_benchmark(uint32_t seed)
+{
+    const int radius = 8;
+    const int chunks_y_min = -2;
+    const int chunks_y_max = 2;
+    uint8_t *blocks = (uint8_t *)malloc(BLOCKS_IN_CHUNK);
+    if (!blocks)
+    {
+        return;
+    }
+
+    uint64_t nchunks = 0;
+    uint64_t nsolid = 0;
+    double start = glfwGetTime();
+    for (int cz = -radius; cz < radius; cz++)
+    {
+        for (int cx = -radius; cx < radius; cx++)
+        {
+            for (int cy = chunks_y_min; cy <= chunks_y_max; cy++)
+            {
+                generate_chunk(seed, cx, cy, cz, blocks);
+                for (int i = 0; i < BLOCKS_IN_CHUNK; i++)
+                {
+                    nsolid += (blocks[i] != BLOCK_AIR);
+                }
+                nchunks++;
+            }
+        }
+    }
+    double generate_s = glfwGetTime() - start;
+    free(blocks);
+
+    const int nsamples = 1 << 20;
+    float scalar_sum = 0.0f;
+    start = glfwGetTime();
+    for (int i = 0; i < nsamples; i++)
+    {
+        float x = (float)(i & 255) * TERRAIN_CAVE_FREQUENCY;
+        float y = (float)((i >> 8) & 63) * TERRAIN_CAVE_FREQUENCY;
+        float z = (float)(i >> 14) * TERRAIN_CAVE_FREQUENCY;
+        scalar_sum += fractal_noise_3d(seed, x, y, z, TERRAIN_CAVE_OCTAVES);
+    }
+    double scalar_s = glfwGetTime() - start;
+
+    __m128 simd_sum = _mm_setzero_ps();
+    __m128 lane = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    start = glfwGetTime();
+    for (int i = 0; i < nsamples; i += 4)
+    {
+        __m128 x = _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)(i & 255)), lane), _mm_set1_ps(TERRAIN_CAVE_FREQUENCY));
+        __m128 y = _mm_set1_ps((float)((i >> 8) & 63) * TERRAIN_CAVE_FREQUENCY);
+        __m128 z = _mm_set1_ps((float)(i >> 14) * TERRAIN_CAVE_FREQUENCY);
+        simd_sum = _mm_add_ps(simd_sum, fractal_noise_3d_x4(seed, x, y, z, TERRAIN_CAVE_OCTAVES));
+    }
+    double simd_s = glfwGetTime() - start;
+
+    float max_error = 0.0f;
+    for (int i = 0; i < nsamples; i += 4093)
+    {
+        int base = i & ~3;
+        __m128 x = _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)(base & 255)), lane), _mm_set1_ps(TERRAIN_CAVE_FREQUENCY));
+        __m128 y = _mm_set1_ps((float)((base >> 8) & 63) * TERRAIN_CAVE_FREQUENCY);
+        __m128 z = _mm_set1_ps((float)(base >> 14) * TERRAIN_CAVE_FREQUENCY);
+        float lanes[4];
+        _mm_storeu_ps(lanes, fractal_noise_3d_x4(seed, x, y, z, TERRAIN_CAVE_OCTAVES));
+        for (int l = 0; l < 4; l++)
+        {
+            float ref = fractal_noise_3d(seed, (float)((base + l) & 255) * TERRAIN_CAVE_FREQUENCY,
+                                         (float)(((base + l) >> 8) & 63) * TERRAIN_CAVE_FREQUENCY,
+                                         (float)((base + l) >> 14) * TERRAIN_CAVE_FREQUENCY, TERRAIN_CAVE_OCTAVES);
+            max_error = std::max(max_error, fabsf(lanes[l] - ref));
+        }
+    }
+
+    float simd_lanes[4];
+    _mm_storeu_ps(simd_lanes, simd_sum);
+    printf("terrain: seed %u, %llu chunks in %.1f ms, %.0f chunks/s per core, %.1f%% solid\n", seed,
+        (unsigned long long)nchunks, generate_s * 1e3, nchunks / generate_s,
+        100.0 * nsolid / (nchunks * BLOCKS_IN_CHUNK));
+    printf("  3d noise, %d octaves: scalar %.1f ns/sample, sse2 %.1f ns/sample (%.2fx), max difference %g (sums %g %g)\n",
+        TERRAIN_CAVE_OCTAVES, scalar_s * 1e9 / nsamples, simd_s * 1e9 / nsamples, scalar_s / simd_s, max_error,
+        scalar_sum, simd_lanes[0] + simd_lanes[1] + simd_lanes[2] + simd_lanes[3]);
+}
+
+struct Job_benchmark
+{
+    uint32_t seed;
+    int side;
+    uint8_t *blocks;
+    uint64_t nsolid;
+};
+
+void job_benchmark_generate(void *data, int begin, int end)
+{
+    Job_benchmark *bench = (Job_benchmark *)data;
+    for (int i = begin; i < end; i++)
+    {
+        int cx = i % bench->side - bench->side / 2;
+        int cz = (i / bench->side) % bench->side - bench->side / 2;
+        int cy = i / (bench->side * bench->side) - 2;
+        generate_chunk(bench->seed, cx, cy, cz, bench->blocks + (size_t)i * BLOCKS_IN_CHUNK);
+    }
+}
+
+void job_benchmark_count(void *data, int begin, int end)
+{
+    (void)begin;
+    (void)end;
+    Job_benchmark *bench = (Job_benchmark *)data;
+    uint64_t nsolid = 0;
+    for (size_t i = 0; i < (size_t)bench->side * bench->side * 5 * BLOCKS_IN_CHUNK; i++)
+    {
+        nsolid += (bench->blocks[i] != BLOCK_AIR);
+    }
+    bench->nsolid = nsolid;
+}
+
+// NOTE(max): generates the same chunks with 1 to N threads and prints how generation scales, the solid block
+// count runs as a job that depends on all generation jobs and has to come out the same every time
+void job_benchmark(uint32_t seed)
+{
+    Job_benchmark bench;
+    bench.seed = seed;
+    bench.side = 24;
+    int nchunks = bench.side * bench.side * 5;
+    bench.blocks = (uint8_t *)malloc((size_t)nchunks * BLOCKS_IN_CHUNK);
+    Job_system *sys = (Job_system *)malloc(sizeof(Job_system));
+    if (!bench.blocks || !sys)
+    {
+        free(bench.blocks);
+        free(sys);
+        return;
+    }
+
+    int ncores = std::min(std::max((int)std::thread::hardware_concurrency(), 1), JOB_MAX_THREADS);
+    double single_s = 0.0;
+    for (int nthreads = 1; nthreads <= ncores; nthreads++)
+    {
+        new (sys) Job_system();
+        job_system_init(sys, nthreads);
+
+        Job_counter generated;
+        Job_counter counted;
+        job_counter_init(&generated);
+        job_counter_init(&counted);
+
+        double start = glfwGetTime();
+        parallel_for(sys, &generated, job_benchmark_generate, &bench, nchunks, 4);
+        if (!job_submit_after(sys, &generated, job_benchmark_count, &bench, 0, 1, &counted))
+        {
+            job_wait(sys, &generated);
+            job_submit(sys, job_benchmark_count, &bench, 0, 1, &counted);
+        }
+        job_wait(sys, &counted);
+        double elapsed_s = glfwGetTime() - start;
+        if (nthreads == 1)
+        {
+            single_s = elapsed_s;
+        }
+
+        printf("jobs: %2d threads, %d chunks in %.1f ms, %.0f chunks/s, speedup %.2fx (%.0f%% efficiency), "
+            "%llu jobs, %llu stolen, %llu solid\n", nthreads, nchunks, elapsed_s * 1e3, nchunks / elapsed_s,
+            single_s / elapsed_s, 100.0 * single_s / (elapsed_s * nthreads),
+            (unsigned long long)sys->executed.load(), (unsigned long long)sys->stolen.load(),
+            (unsigned long long)bench.nsolid);
+
+        job_system_shutdown(sys);
+        sys->~Job_system();
+    }
+
+    free(sys);
+    free(bench.blocks);
+}
+
+// NOTE(max): saves a world of about 10k chunks to region files in dir, then loads it back through new mappings and
+// compares that with generating the same chunks again
+void region_benchmark(uint32_t seed, const char *dir)
+{
+    const int side = 45;
+    const int height = 5;
+    int nchunks = side * side * height;
+    uint8_t *world = (uint8_t *)malloc((size_t)nchunks * BLOCKS_IN_CHUNK);
+    uint8_t *blocks = (uint8_t *)malloc(BLOCKS_IN_CHUNK);
+    Memory_arena arena;
+    size_t arena_size = REGION_CACHE_SIZE * sizeof(Region_header);
+    uint8_t *arena_memory = (uint8_t *)malloc(arena_size);
+    Region_cache *cache = (Region_cache *)malloc(sizeof(Region_cache));
+    if (!world || !blocks || !arena_memory || !cache)
+    {
+        free(world);
+        free(blocks);
+        free(arena_memory);
+        free(cache);
+        return;
+    }
+    memory_arena_init(&arena, arena_memory, arena_size);
+    region_cache_init(cache, &arena, dir);
+
+    double start = glfwGetTime();
+    for (int i = 0; i < nchunks; i++)
+    {
+        generate_chunk(seed, i % side - side / 2, i / (side * side) - 2, (i / side) % side - side / 2,
+                       world + (size_t)i * BLOCKS_IN_CHUNK);
+    }
+    double generate_s = glfwGetTime() - start;
+
+    start = glfwGetTime();
+    for (int i = 0; i < nchunks; i++)
+    {
+        region_write_chunk(cache, i % side - side / 2, i / (side * side) - 2, (i / side) % side - side / 2,
+                           world + (size_t)i * BLOCKS_IN_CHUNK);
+    }
+    uint64_t file_bytes = 0;
+    int nfiles = 0;
+    for (int i = 0; i < REGION_CACHE_SIZE; i++)
+    {
+        if (cache->regions[i].used && cache->regions[i].exists)
+        {
+            file_bytes += cache->regions[i].file_size;
+            nfiles++;
+        }
+    }
+    region_cache_close_all(cache);
+    double write_s = glfwGetTime() - start;
+
+    int nloaded = 0;
+    int nwrong = 0;
+    start = glfwGetTime();
+    for (int i = 0; i < nchunks; i++)
+    {
+        if (region_read_chunk(cache, i % side - side / 2, i / (side * side) - 2, (i / side) % side - side / 2, blocks))
+        {
+            nloaded++;
+            nwrong += memcmp(blocks, world + (size_t)i * BLOCKS_IN_CHUNK, BLOCKS_IN_CHUNK) != 0;
+        }
+    }
+    double load_s = glfwGetTime() - start;
+
+    printf("regions: %d chunks, %d files, %.1f MB on disk (%.1f%% of raw, %.0f bytes per chunk)\n", nchunks, nfiles,
+        file_bytes / (1024.0 * 1024.0), 100.0 * file_bytes / ((double)nchunks * BLOCKS_IN_CHUNK),
+        (double)(file_bytes - nfiles * sizeof(Region_header)) / nchunks);
+    printf("  generate %.1f ms, write %.1f ms, load %.1f ms (%d loaded, %d wrong), load is %.1fx faster than generating\n",
+        generate_s * 1e3, write_s * 1e3, load_s * 1e3, nloaded, nwrong, generate_s / load_s);
+
+    for (int i = 0; i < REGION_CACHE_SIZE; i++)
+    {
+        if (cache->regions[i].used)
+        {
+            char path[REGION_PATH_MAX];
+            bool have_path = region_path(cache, cache->regions[i].x, cache->regions[i].y, cache->regions[i].z, "", path);
+            region_close(&cache->regions[i]);
+            if (have_path)
+            {
+                remove(path);
+            }
+        }
+    }
+
+    free(world);
+    free(blocks);
+    free(arena_memory);
+    free(cache);
+}
+
+// NOTE(max): traces random rays from the air of a generated world one at a time and in batches, the two must
+// agree block for block
+void raycast_benchmark(uint32_t seed)
+{
+    const int side = 16;
+    const int height = 6;
+    const int nrays = 100000;
+    size_t arena_size = (size_t)side * side * height * (sizeof(Chunk) + BLOCKS_IN_CHUNK) + (64ull << 20);
+    uint8_t *arena_memory = (uint8_t *)malloc(arena_size);
+    World *world = (World *)malloc(sizeof(World));
+    uint8_t *blocks = (uint8_t *)malloc(BLOCKS_IN_CHUNK);
+    Vec3f *origins = (Vec3f *)malloc(nrays * sizeof(Vec3f));
+    Vec3f *dirs = (Vec3f *)malloc(nrays * sizeof(Vec3f));
+    Raycast_result *results = (Raycast_result *)malloc(nrays * sizeof(Raycast_result));
+    Memory_arena arena;
+    bool ok = arena_memory && world && blocks && origins && dirs && results;
+    if (ok)
+    {
+        memory_arena_init(&arena, arena_memory, arena_size);
+        ok = world_init(world, &arena);
+    }
+    for (int i = 0; ok && (i < side * side * height); i++)
+    {
+        int x = i % side - side / 2;
+        int y = i / (side * side) - 2;
+        int z = (i / side) % side - side / 2;
+        Chunk *c = world_add_chunk(world, &arena, x, y, z);
+        generate_chunk(seed, x, y, z, blocks);
+        ok = c && chunk_set_all_blocks(&world->block_storage, c, blocks);
+    }
+
+    uint32_t rng = seed | 1;
+    int nstarted = 0;
+    while (ok && (nstarted < nrays))
+    {
+        float r[6];
+        for (int i = 0; i < 6; i++)
+        {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            r[i] = (float)(rng >> 8) * (1.0f / 16777216.0f);
+        }
+        Vec3f pos((r[0] - 0.5f) * side * CHUNK_DIM, (r[1] * height - 2) * CHUNK_DIM, (r[2] - 0.5f) * side * CHUNK_DIM);
+        int v[3] = {(int)floorf(pos.x), (int)floorf(pos.y), (int)floorf(pos.z)};
+        if (raycast_box_log2(world_find_chunk(world, v[0] >> CHUNK_DIM_LOG2, v[1] >> CHUNK_DIM_LOG2, v[2] >> CHUNK_DIM_LOG2), v) >= 0)
+        {
+            origins[nstarted] = pos;
+            dirs[nstarted] = Vec3f(r[3] * 2.0f - 1.0f, (r[4] * 2.0f - 1.0f) * 0.5f, r[5] * 2.0f - 1.0f);
+            nstarted++;
+        }
+    }
+
+    for (int pass = 0; ok && (pass < 3); pass++)
+    {
+        float max_len = (float)(CHUNK_DIM << (2 * pass));
+        double start = glfwGetTime();
+        int nhits = 0;
+        for (int i = 0; i < nrays; i++)
+        {
+            nhits += raycast(world, origins[i], dirs[i], max_len).collision;
+        }
+        double single_s = glfwGetTime() - start;
+
+        start = glfwGetTime();
+        raycast_batch(world, origins, dirs, nrays, max_len, results);
+        double batch_s = glfwGetTime() - start;
+
+        int nwrong = 0;
+        for (int i = 0; i < nrays; i++)
+        {
+            Raycast_result rc = raycast(world, origins[i], dirs[i], max_len);
+            nwrong += (rc.collision != results[i].collision) || (rc.i != results[i].i) || (rc.j != results[i].j) ||
+                      (rc.k != results[i].k) || (rc.last_t != results[i].last_t);
+        }
+
+        printf("raycast: %d rays of %.0f blocks, %d hit, one at a time %.3f us/ray, batched %.3f us/ray (%.2fx), %d wrong\n",
+            nrays, max_len, nhits, single_s * 1e6 / nrays, batch_s * 1e6 / nrays, single_s / batch_s, nwrong);
+    }
+
+    free(results);
+    free(dirs);
+    free(origins);
+    free(blocks);
+    free(world);
+    free(arena_memory);
+}
+
+// NOTE(max): light of a world of side x height x side chunks recomputed from scratch with one dense fill, the
+// reference light_benchmark compares the engine with. Cells are indexed like blocks, with the world dimensions.
+void light_bench_recompute(World *world, uint32_t seed, int side, int height, int *queue, uint8_t *queued,
+                           uint8_t *blocks, uint8_t *light)
+{
+    int w = side * CHUNK_DIM;
+    int h = height * CHUNK_DIM;
+    int ncells = w * h * w;
+    for (int y = 0; y < h; y++)
+    {
+        for (int z = 0; z < w; z++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                Chunk *c = world_find_chunk(world, x / CHUNK_DIM - side / 2, y / CHUNK_DIM - 1, z / CHUNK_DIM - side / 2);
+                int idx = CHUNK_DIM * CHUNK_DIM * (y % CHUNK_DIM) + CHUNK_DIM * (z % CHUNK_DIM) + (x % CHUNK_DIM);
+                int cell = (y * w + z) * w + x;
+                blocks[cell] = chunk_get_block_idx(c, idx);
+                light[cell] = Block_light_emission[blocks[cell]];
+            }
+        }
+    }
+
+    // NOTE(max): nothing is above the top chunks, the terrain height decides which of their columns are open (see
+    // light_column_open)
+    for (int z = 0; z < w; z++)
+    {
+        for (int x = 0; x < w; x++)
+        {
+            if ((height - 1) * CHUNK_DIM <= terrain_height(seed, x - side / 2 * CHUNK_DIM, z - side / 2 * CHUNK_DIM))
+            {
+                continue;
+            }
+            for (int y = h - 1; (y >= 0) && (blocks[(y * w + z) * w + x] == BLOCK_AIR); y--)
+            {
+                light[(y * w + z) * w + x] = LIGHT_MAX << LIGHT_SKY_SHIFT;
+            }
+        }
+    }
+
+    int head = 0;
+    int count = 0;
+    for (int cell = 0; cell < ncells; cell++)
+    {
+        queued[cell] = light[cell] != 0;
+        if (queued[cell])
+        {
+            queue[count++] = cell;
+        }
+    }
+
+    while (count)
+    {
+        int cell = queue[head];
+        head = (head + 1) % ncells;
+        count--;
+        queued[cell] = 0;
+
+        int sky = light[cell] >> LIGHT_SKY_SHIFT;
+        int block = light[cell] & LIGHT_MAX;
+        int p[3] = {cell % w, cell / (w * w), (cell / w) % w};
+        for (int f = 0; f < FACE_COUNT; f++)
+        {
+            int q[3] = {p[0] + Face_normals[f][0], p[1] + Face_normals[f][1], p[2] + Face_normals[f][2]};
+            if ((q[0] < 0) || (q[0] >= w) || (q[1] < 0) || (q[1] >= h) || (q[2] < 0) || (q[2] >= w))
+            {
+                continue;
+            }
+            int n = (q[1] * w + q[2]) * w + q[0];
+            if (blocks[n] != BLOCK_AIR)
+            {
+                continue;
+            }
+
+            int n_sky = std::max(light[n] >> LIGHT_SKY_SHIFT, ((f == FACE_BOTTOM) && (sky == LIGHT_MAX)) ? LIGHT_MAX : (sky - 1));
+            int n_block = std::max(light[n] & LIGHT_MAX, block - 1);
+            uint8_t n_light = (uint8_t)((n_sky << LIGHT_SKY_SHIFT) | n_block);
+            if (n_light != light[n])
+            {
+                light[n] = n_light;
+                if (!queued[n])
+                {
+                    queued[n] = 1;
+                    queue[(head + count++) % ncells] = n;
+                }
+            }
+        }
+    }
+}
+
+// NOTE(max): blocks of the world whose engine light differs from the reference
+int light_bench_mismatches(World *world, int side, int height, uint8_t *light)
+{
+    int w = side * CHUNK_DIM;
+    int h = height * CHUNK_DIM;
+    int result = 0;
+    for (int y = 0; y < h; y++)
+    {
+        for (int z = 0; z < w; z++)
+        {
+            for (int x = 0; x < w; x++)
+            {
+                Chunk *c = world_find_chunk(world, x / CHUNK_DIM - side / 2, y / CHUNK_DIM - 1, z / CHUNK_DIM - side / 2);
+                int idx = CHUNK_DIM * CHUNK_DIM * (y % CHUNK_DIM) + CHUNK_DIM * (z % CHUNK_DIM) + (x % CHUNK_DIM);
+                result += chunk_get_light_idx(c, idx) != light[(y * w + z) * w + x];
+            }
+        }
+    }
+    return (result);
+}
+
+// NOTE(max): lights a small generated world chunk by chunk in random order, then digs, builds and places lamps at
+// random. After the load and after every round of edits the light has to match a full recompute.
+void light_benchmark(uint32_t seed)
+{
+    const int side = 4;
+    const int height = 4;
+    const int nrounds = 16;
+    const int nedits = 256;
+    int nchunks = side * side * height;
+    int ncells = nchunks * BLOCKS_IN_CHUNK;
+    size_t arena_size = (size_t)nchunks * (sizeof(Chunk) + 2 * BLOCKS_IN_CHUNK) + (64ull << 20);
+    uint8_t *arena_memory = (uint8_t *)malloc(arena_size);
+    World *world = (World *)malloc(sizeof(World));
+    Light_engine *engine = (Light_engine *)malloc(sizeof(Light_engine));
+    Chunk **order = (Chunk **)malloc(nchunks * sizeof(Chunk *));
+    int *queue = (int *)malloc(ncells * sizeof(int));
+    uint8_t *queued = (uint8_t *)malloc(ncells);
+    uint8_t *blocks = (uint8_t *)malloc(ncells);
+    uint8_t *light = (uint8_t *)malloc(ncells);
+    Memory_arena arena;
+    bool ok = arena_memory && world && engine && order && queue && queued && blocks && light;
+    if (ok)
+    {
+        memory_arena_init(&arena, arena_memory, arena_size);
+        ok = world_init(world, &arena) && light_init(engine, world, &arena, seed);
+    }
+    for (int i = 0; ok && (i < nchunks); i++)
+    {
+        order[i] = world_add_chunk(world, &arena, i % side - side / 2, i / (side * side) - 1, (i / side) % side - side / 2);
+        ok = order[i] != 0;
+    }
+
+    uint32_t rng = seed | 1;
+    for (int i = nchunks - 1; ok && (i > 0); i--)
+    {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        int j = rng % (i + 1);
+        Chunk *c = order[i];
+        order[i] = order[j];
+        order[j] = c;
+    }
+
+    // NOTE(max): chunks come in like the streamer brings them, their neighbours may or may not be there yet
+    for (int i = 0; ok && (i < nchunks); i++)
+    {
+        Chunk *c = order[i];
+        generate_chunk(seed, c->x, c->y, c->z, blocks);
+        ok = chunk_set_all_blocks(&world->block_storage, c, blocks);
+        c->generated = true;
+        light_chunk_init(engine, c);
+    }
+    double edit_us = 0.0;
+    if (ok)
+    {
+        edit_us = engine->stats.time_us;
+        light_bench_recompute(world, seed, side, height, queue, queued, blocks, light);
+        printf("light: %d chunks lit, %.1f us/chunk, %d blocks differ from a full recompute\n", nchunks,
+            edit_us / nchunks, light_bench_mismatches(world, side, height, light));
+    }
+
+    int nchecks = 0;
+    int nmismatches = 0;
+    int ndone = 0;
+    for (int round = 0; ok && (round < nrounds); round++)
+    {
+        for (int i = 0; ok && (i < nedits); i++)
+        {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            Chunk *c = order[rng % nchunks];
+            int x = (rng >> 8) & (CHUNK_DIM - 1);
+            int y = (rng >> 12) & (CHUNK_DIM - 1);
+            int z = (rng >> 16) & (CHUNK_DIM - 1);
+            // NOTE(max): mostly digging and building, one edit in eight places a lamp
+            int r = (rng >> 20) & 7;
+            uint8_t type = (uint8_t)((r == 0) ? BLOCK_LAMP : ((r < 4) ? BLOCK_STONE : BLOCK_AIR));
+            uint8_t old_type = chunk_get_block(c, x, y, z);
+            ok = chunk_set_block(&world->block_storage, c, x, y, z, type);
+            light_block_changed(engine, c, x, y, z, old_type);
+            ndone++;
+        }
+
+        light_bench_recompute(world, seed, side, height, queue, queued, blocks, light);
+        nmismatches += light_bench_mismatches(world, side, height, light);
+        nchecks++;
+    }
+
+    if (ok)
+    {
+        printf("light: %d edits, %.1f us/edit, %d checks, %d blocks differ from a full recompute, %llu nodes dropped\n",
+            ndone, (engine->stats.time_us - edit_us) / ndone, nchecks, nmismatches,
+            (unsigned long long)engine->stats.dropped);
+    }
+    else
+    {
+        printf("light: out of memory\n");
+    }
 
-                if (c->blocks[CHUNK_DIM * CHUNK_DIM * block_y + CHUNK_DIM * block_z + block_x] != BLOCK_AIR)
-                {
-                    chunk = c;
-                    collision = true;
-                    goto end_loop;
-                }
-            }
+    free(light);
+    free(blocks);
+    free(queued);
+    free(queue);
+    free(order);
+    free(engine);
+    free(world);
+    free(arena_memory);
+}
 
-            c = c->next;
-        }
+// NOTE(max): the workers also generate terrain for the streamer, the result is left in blocks
+enum Mesh_job_kind
+{
+    MESH_JOB_MESH,
+    MESH_JOB_GENERATE,
+};
+
+struct Mesh_job
+{
+    Mesh_job_kind kind;
+    Chunk_handle chunk;
+    int chunk_x;
+    int chunk_y;
+    int chunk_z;
+    uint32_t seed;
+    uint32_t generation;
+    Mesher_mode mode;
+    Vertex_format format;
+
+    // NOTE(max): snapshot of the chunk blocks followed by the blocks of its neighbours, input points into it
+    uint8_t blocks[(1 + FACE_COUNT) * BLOCKS_IN_CHUNK];
+    // NOTE(max): same for light
+    uint8_t light[(1 + FACE_COUNT) * BLOCKS_IN_CHUNK];
+    Mesher_input input;
+
+    // NOTE(max): reset for every job, result vertices live here until they are uploaded
+    uint8_t *memory;
+    Memory_arena arena;
+
+    bool succeeded;
+    // NOTE(max): worker time spent in mesh_chunk or generate_chunk
+    double work_us;
+    Chunk_mesh_data result;
+    uint64_t face_links;
+};
+
+void mesh_job_proc(void *data, int job_idx, int end)
+{
+    (void)end;
+    Mesh_pool *pool = (Mesh_pool *)data;
+    Mesh_job *job = &pool->jobs[job_idx];
+
+    memory_arena_init(&job->arena, job->memory, MESH_JOB_MEMORY_SIZE);
+    double start = glfwGetTime();
+    if (job->kind == MESH_JOB_GENERATE)
+    {
+        generate_chunk(job->seed, job->chunk_x, job->chunk_y, job->chunk_z, job->blocks);
+        job->succeeded = true;
+    }
+    else
+    {
+        job->succeeded = mesh_chunk(&job->input, job->mode, job->format, &job->arena, &job->result);
+        job->face_links = chunk_face_links(job->blocks);
+    }
+    job->work_us = (glfwGetTime() - start) * 1e6;
+
+    std::lock_guard<std::mutex> lock(pool->mutex);
+    pool->done[pool->ndone++] = job_idx;
+}
+
+bool mesh_pool_init(Mesh_pool *pool, Job_system *job_system, Memory_arena *arena)
+{
+    pool->job_system = job_system;
+    pool->jobs = (Mesh_job *)memory_arena_alloc(arena, MESH_JOB_COUNT * sizeof(Mesh_job));
+    if (!pool->jobs)
+    {
+        return (false);
+    }
 
-        if (i == i_end && j == j_end && k == k_end)
+    for (int i = 0; i < MESH_JOB_COUNT; i++)
+    {
+        pool->jobs[i].memory = (uint8_t *)memory_arena_alloc(arena, MESH_JOB_MEMORY_SIZE);
+        if (!pool->jobs[i].memory)
         {
-            break;
+            return (false);
         }
+        pool->free_jobs[i] = i;
+    }
+    pool->nfree = MESH_JOB_COUNT;
 
-        if (t_x <= t_y && t_x <= t_z)
-        {
-            last_di = di;
-            last_dj = 0;
-            last_dk = 0;
+    pool->ndone = 0;
 
-            last_t = t_x;
-            t_x += dt_x;
-            i += di;
-        }
-        else if (t_y <= t_x && t_y <= t_z)
-        {
-            last_di = 0;
-            last_dj = dj;
-            last_dk = 0;
+    return (true);
+}
+
+void mesh_pool_push_pending(Mesh_pool *pool, int job_idx)
+{
+    job_submit(pool->job_system, mesh_job_proc, pool, job_idx, job_idx + 1, 0);
+}
+
+void mesh_pool_submit_generate(Mesh_pool *pool, Chunk *c, uint32_t seed)
+{
+    assert(pool->nfree > 0);
+    int job_idx = pool->free_jobs[--pool->nfree];
+    Mesh_job *job = &pool->jobs[job_idx];
+
+    job->kind = MESH_JOB_GENERATE;
+    job->seed = seed;
+    job->chunk = chunk_handle(c);
+    job->chunk_x = c->x;
+    job->chunk_y = c->y;
+    job->chunk_z = c->z;
+
+    mesh_pool_push_pending(pool, job_idx);
+}
 
-            last_t = t_y;
-            t_y += dt_y;
-            j += dj;
+// NOTE(max): copies the blocks and light the mesher reads, so the chunk can be edited while the job is in flight
+void mesh_pool_submit(Mesh_pool *pool, Chunk *c, Mesher_mode mode, Vertex_format format)
+{
+    assert(pool->nfree > 0);
+    int job_idx = pool->free_jobs[--pool->nfree];
+    Mesh_job *job = &pool->jobs[job_idx];
+
+    job->kind = MESH_JOB_MESH;
+    job->chunk = chunk_handle(c);
+    job->generation = c->mesh_generation;
+    job->mode = mode;
+    job->format = format;
+
+    job->input.nblocks = c->nblocks;
+    job->input.blocks = job->blocks;
+    job->input.light = job->light;
+    chunk_copy_blocks(c, job->blocks);
+    chunk_copy_light(c, job->light);
+    for (int f = 0; f < FACE_COUNT; f++)
+    {
+        Chunk *n = c->neighbours[f];
+        if (n)
+        {
+            job->input.neighbours[f] = job->blocks + (1 + f) * BLOCKS_IN_CHUNK;
+            job->input.neighbour_light[f] = job->light + (1 + f) * BLOCKS_IN_CHUNK;
+            chunk_copy_blocks(n, job->input.neighbours[f]);
+            chunk_copy_light(n, job->input.neighbour_light[f]);
         }
         else
         {
-            last_di = 0;
-            last_dj = 0;
-            last_dk = dk;
-
-            last_t = t_z;
-            t_z += dt_z;
-            k += dk;
+            job->input.neighbours[f] = 0;
+            job->input.neighbour_light[f] = 0;
         }
     }
 
-end_loop:
-    float dx2 = (end_x - start_x) * (end_x - start_x);
-    float dy2 = (end_y - start_y) * (end_y - start_y);
-    float dz2 = (end_z - start_z) * (end_z - start_z);
-    last_t *= sqrtf(dx2 + dy2 + dz2);
+    mesh_pool_push_pending(pool, job_idx);
+}
+
+// NOTE(max): returns number of finished jobs written to job_idxs, they have to be given back with mesh_pool_release
+// NOTE(max): oldest finished jobs first
+int mesh_pool_take_done(Mesh_pool *pool, int *job_idxs, int max_jobs)
+{
+    std::lock_guard<std::mutex> lock(pool->mutex);
 
-    result.collision = collision;
-    result.i = i;
-    result.j = j;
-    result.k = k;
-    result.last_i = i - last_di;
-    result.last_j = j - last_dj;
-    result.last_k = k - last_dk;
-    result.last_t = last_t;
-    result.chunk = chunk;
+    int result = std::min(pool->ndone, max_jobs);
+    for (int i = 0; i < result; i++)
+    {
+        job_idxs[i] = pool->done[i];
+    }
+    for (int i = result; i < pool->ndone; i++)
+    {
+        pool->done[i - result] = pool->done[i];
+    }
+    pool->ndone -= result;
 
     return (result);
 }
 
-struct Range3d
+void mesh_pool_release(Mesh_pool *pool, int job_idx)
 {
-    uint8_t type;
+    assert(pool->nfree < MESH_JOB_COUNT);
+    pool->free_jobs[pool->nfree++] = job_idx;
+}
 
-    int start_x;
-    int start_y;
-    int start_z;
+inline uint32_t gpu_pages_for(int num_of_vs)
+{
+    return ((uint32_t)(num_of_vs + GPU_PAGE_VERTICES - 1) / GPU_PAGE_VERTICES);
+}
 
-    int end_x;
-    int end_y;
-    int end_z;
-};
+void gpu_buffer_bind_attributes(Gpu_buffer *b)
+{
+    glBindVertexArray(b->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, b->vbo);
+    if (b->format == VERTEX_FORMAT_PACKED)
+    {
+        glVertexAttribIPointer(2, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void *)0);
+        glEnableVertexAttribArray(2);
+    }
+    else
+    {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Float_vertex), (void *)offsetof(Float_vertex, pos));
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Float_vertex), (void *)offsetof(Float_vertex, normal));
+        glEnableVertexAttribArray(1);
+        glVertexAttribIPointer(3, 1, GL_UNSIGNED_INT, sizeof(Float_vertex), (void *)offsetof(Float_vertex, type));
+        glEnableVertexAttribArray(3);
+        glVertexAttribIPointer(4, 1, GL_UNSIGNED_INT, sizeof(Float_vertex), (void *)offsetof(Float_vertex, light));
+        glEnableVertexAttribArray(4);
+    }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
 
-void gen_ranges_3d(uint8_t *blocks, Range3d *ranges, uint8_t *visited, int dim, int count, int *num_of_ranges)
+// NOTE(max): a new vertex buffer of npages with the live slots copied to its front in page order, the page offsets
+// buffer is sized and filled again. Slots only move down, so owners and offsets are moved in place.
+void gpu_buffer_relayout(Gpu_buffer *b, uint32_t npages)
 {
-    int ranges_count = 0;
+    assert(b->used_pages <= npages);
 
-    while (count > 0)
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)npages * GPU_PAGE_VERTICES * b->vertex_size, 0, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, b->vbo);
+
+    uint32_t next = 0;
+    for (uint32_t page = 0; page < b->npages;)
     {
-        int start_z = 0;
-        int end_z = 0;
+        Chunk *c = b->owners[page];
+        if (!c)
+        {
+            page++;
+            continue;
+        }
 
-        int start_y = 0;
-        int end_y = 0;
+        Mesh *m = &c->mesh;
+        assert(m->first_page == page);
+        uint32_t page_bytes = GPU_PAGE_VERTICES * b->vertex_size;
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)page * page_bytes,
+                            (GLintptr)next * page_bytes, (GLsizeiptr)m->npages * page_bytes);
+        if (next != page)
+        {
+            memmove(&b->owners[next], &b->owners[page], m->npages * sizeof(Chunk *));
+            memmove(&b->offsets[4 * next], &b->offsets[4 * page], 4 * m->npages * sizeof(int32_t));
+            b->stats.pages_moved += m->npages;
+        }
+        m->first_page = next;
+        page += m->npages;
+        next += m->npages;
+    }
+    assert(next == b->used_pages);
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    glDeleteBuffers(1, &b->vbo);
+    b->vbo = vbo;
+    gpu_buffer_bind_attributes(b);
+
+    memset(&b->owners[next], 0, (npages - next) * sizeof(Chunk *));
+    memset(&b->offsets[4 * next], 0, 4 * (npages - next) * sizeof(int32_t));
+    glBindBuffer(GL_TEXTURE_BUFFER, b->offsets_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, (GLsizeiptr)npages * 4 * sizeof(int32_t), b->offsets, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    b->npages = npages;
+    b->nfree = 0;
+    if (next < npages)
+    {
+        b->free_ranges[b->nfree++] = { next, npages - next };
+    }
+}
 
-        int start_x = 0;
-        int end_x = 0;
+// NOTE(max): the CPU side lives in arena, GL objects are made here. Everything starts out free.
+bool gpu_buffer_init(Gpu_buffer *b, Vertex_format format, Memory_arena *arena)
+{
+    b->format = format;
+    b->vertex_size = (format == VERTEX_FORMAT_PACKED) ? sizeof(uint32_t) : sizeof(Float_vertex);
+    b->npages = 0;
+    b->used_pages = 0;
+    b->nfree = 0;
+    b->stats = {};
+    b->free_ranges = (Gpu_range *)memory_arena_alloc(arena, (GPU_BUFFER_MAX_PAGES / 2 + 1) * sizeof(Gpu_range));
+    b->owners = (Chunk **)memory_arena_alloc(arena, GPU_BUFFER_MAX_PAGES * sizeof(Chunk *));
+    b->offsets = (int32_t *)memory_arena_alloc(arena, 4 * GPU_BUFFER_MAX_PAGES * sizeof(int32_t));
+    if (!b->free_ranges || !b->owners || !b->offsets)
+    {
+        return (false);
+    }
 
-        // skip all visited and empty blocks
-        for (start_y = 0; start_y < dim; start_y++)
+    b->vbo = 0;
+    glGenVertexArrays(1, &b->vao);
+    glGenBuffers(1, &b->offsets_buffer);
+    glGenTextures(1, &b->offsets_texture);
+    gpu_buffer_relayout(b, GPU_BUFFER_INITIAL_PAGES);
+
+    glBindTexture(GL_TEXTURE_BUFFER, b->offsets_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32I, b->offsets_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+
+    return (true);
+}
+
+inline bool gpu_buffer_find_free(Gpu_buffer *b, uint32_t npages, uint32_t *first)
+{
+    for (int i = 0; i < b->nfree; i++)
+    {
+        Gpu_range *r = &b->free_ranges[i];
+        if (r->count >= npages)
         {
-            for (start_z = 0; start_z < dim; start_z++)
+            *first = r->first;
+            r->first += npages;
+            r->count -= npages;
+            if (r->count == 0)
             {
-                for (start_x = 0; start_x < dim; start_x++)
-                {
-                    if (visited[start_y * dim * dim + start_z * dim + start_x] == 0 &&
-                        blocks[start_y * dim * dim + start_z * dim + start_x] != BLOCK_AIR)
-                    {
-                        goto break1;
-                    }
-                }
+                memmove(r, r + 1, (b->nfree - i - 1) * sizeof(Gpu_range));
+                b->nfree--;
             }
+            return (true);
         }
-    break1:
+    }
+    return (false);
+}
 
-        // If a block at (start_x, start_y, start_z) is in the grid (the grid is not empty), mark it as visited.
-        // Also record block type.
-        uint8_t block_type = BLOCK_AIR;
-        if (start_x < dim && start_y < dim && start_z < dim)
+// NOTE(max): compacts when the free pages are enough but scattered, grows otherwise. False once the buffer would
+// have to grow past GPU_BUFFER_MAX_PAGES.
+bool gpu_buffer_alloc(Gpu_buffer *b, uint32_t npages, uint32_t *first)
+{
+    if (!gpu_buffer_find_free(b, npages, first))
+    {
+        uint32_t new_npages = b->npages;
+        while ((new_npages - b->used_pages < npages) && (new_npages < GPU_BUFFER_MAX_PAGES))
         {
-            visited[start_y * dim * dim + start_z * dim + start_x] = 1;
-            block_type = blocks[start_y * dim * dim + start_z * dim + start_x];
-            count--;
+            new_npages *= 2;
+        }
+        if (new_npages - b->used_pages < npages)
+        {
+            b->stats.failed++;
+            return (false);
         }
 
-        // try expand in x direction
-        end_x = start_x;
-        while ((end_x + 1 < dim) &&
-            (blocks[start_y * dim * dim + start_z * dim + (end_x + 1)] == block_type) &&
-            (visited[start_y * dim * dim + start_z * dim + (end_x + 1)] == 0))
+        if (new_npages == b->npages)
         {
-            visited[start_y * dim * dim + start_z * dim + (end_x + 1)] = 1;
-            end_x++;
-            count--;
+            b->stats.compactions++;
         }
+        else
+        {
+            b->stats.grows++;
+        }
+        gpu_buffer_relayout(b, new_npages);
 
-        // try expand in z direction
-        end_z = start_z;
-        while (end_z + 1 < dim)
+        // NOTE(max): the relayout leaves every free page in one range at the end, this only fails on a bug
+        if (!gpu_buffer_find_free(b, npages, first))
         {
-            bool can_expand = true;
-            for (int x = start_x; x <= end_x; x++)
-            {
-                if (blocks[start_y * dim * dim + (end_z + 1) * dim + x] != block_type ||
-                    visited[start_y * dim * dim + (end_z + 1) * dim + x] == 1)
-                {
-                    can_expand = false;
-                    break;
-                }
-            }
+            b->stats.failed++;
+            return (false);
+        }
+    }
 
-            if (can_expand)
-            {
-                // mark expanded row of block as visited
-                for (int x = start_x; x <= end_x; x++)
-                {
-                    visited[start_y * dim * dim + (end_z + 1) * dim + x] = 1;
-                }
-                end_z++;
-                count -= end_x - start_x + 1;
-            }
-            else
+    b->used_pages += npages;
+    b->stats.allocs++;
+    return (true);
+}
+
+void gpu_buffer_free(Gpu_buffer *b, uint32_t first, uint32_t npages)
+{
+    assert(npages && (b->used_pages >= npages));
+    b->used_pages -= npages;
+    b->stats.frees++;
+    memset(&b->owners[first], 0, npages * sizeof(Chunk *));
+
+    int i = 0;
+    while ((i < b->nfree) && (b->free_ranges[i].first < first))
+    {
+        i++;
+    }
+
+    bool merge_prev = (i > 0) && (b->free_ranges[i - 1].first + b->free_ranges[i - 1].count == first);
+    bool merge_next = (i < b->nfree) && (first + npages == b->free_ranges[i].first);
+    if (merge_prev && merge_next)
+    {
+        b->free_ranges[i - 1].count += npages + b->free_ranges[i].count;
+        memmove(&b->free_ranges[i], &b->free_ranges[i + 1], (b->nfree - i - 1) * sizeof(Gpu_range));
+        b->nfree--;
+    }
+    else if (merge_prev)
+    {
+        b->free_ranges[i - 1].count += npages;
+    }
+    else if (merge_next)
+    {
+        b->free_ranges[i].first = first;
+        b->free_ranges[i].count += npages;
+    }
+    else
+    {
+        assert(b->nfree < GPU_BUFFER_MAX_PAGES / 2 + 1);
+        memmove(&b->free_ranges[i + 1], &b->free_ranges[i], (b->nfree - i) * sizeof(Gpu_range));
+        b->free_ranges[i] = { first, npages };
+        b->nfree++;
+    }
+}
+
+// NOTE(max): pages of the slot of c point the vertex shaders at c
+void gpu_buffer_set_owner(Gpu_buffer *b, Chunk *c)
+{
+    Mesh *m = &c->mesh;
+    for (uint32_t i = 0; i < m->npages; i++)
+    {
+        uint32_t page = m->first_page + i;
+        b->owners[page] = c;
+        b->offsets[4 * page + 0] = c->x * CHUNK_DIM;
+        b->offsets[4 * page + 1] = c->y * CHUNK_DIM;
+        b->offsets[4 * page + 2] = c->z * CHUNK_DIM;
+        b->offsets[4 * page + 3] = 0;
+    }
+
+    glBindBuffer(GL_TEXTURE_BUFFER, b->offsets_buffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)m->first_page * 4 * sizeof(int32_t),
+                    (GLsizeiptr)m->npages * 4 * sizeof(int32_t), &b->offsets[4 * m->first_page]);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+// NOTE(max): CPU side consistency check of the page allocator. The free ranges are sorted, merged and unowned,
+// together with the used pages they cover the buffer, and the pages of every chunk slot in this buffer point at
+// the chunk and its block offset. Walks every page and chunk, it is meant for the stats print.
+bool gpu_buffer_valid(Gpu_buffer *b, World *world)
+{
+    uint32_t free_pages = 0;
+    for (int i = 0; i < b->nfree; i++)
+    {
+        Gpu_range *r = &b->free_ranges[i];
+        if ((r->count == 0) || (r->first + r->count > b->npages) ||
+            ((i > 0) && (b->free_ranges[i - 1].first + b->free_ranges[i - 1].count >= r->first)))
+        {
+            return (false);
+        }
+        for (uint32_t page = r->first; page < r->first + r->count; page++)
+        {
+            if (b->owners[page])
             {
-                break;
+                return (false);
             }
         }
+        free_pages += r->count;
+    }
+    if (free_pages + b->used_pages != b->npages)
+    {
+        return (false);
+    }
 
-        // try expand in y direction
-        end_y = start_y;
-        while (end_y + 1 < dim)
+    uint32_t owned_pages = 0;
+    for (uint32_t page = 0; page < b->npages; page++)
+    {
+        owned_pages += (b->owners[page] != 0);
+    }
+
+    uint32_t slot_pages = 0;
+    for (Chunk *c = world->next; c; c = c->next)
+    {
+        Mesh *m = &c->mesh;
+        if ((m->npages == 0) || (m->format != b->format))
         {
-            bool can_expand = true;
-            for (int z = start_z; z <= end_z; z++)
-            {
-                for (int x = start_x; x <= end_x; x++)
-                {
-                    if (blocks[(end_y + 1) * dim * dim + z * dim + x] != block_type ||
-                        visited[(end_y + 1) * dim * dim + z * dim + x] == 1)
-                    {
-                        can_expand = false;
-                        goto break2;
-                    }
-                }
-            }
-        break2:
-            if (can_expand)
-            {
-                for (int z = start_z; z <= end_z; z++)
-                {
-                    for (int x = start_x; x <= end_x; x++)
-                    {
-                        visited[(end_y + 1) * dim * dim + z * dim + x] = 1;
-                    }
-                }
-                end_y++;
-                count -= (end_x - start_x + 1) * (end_z - start_z + 1);
-            }
-            else
+            continue;
+        }
+        if ((m->first_page + m->npages > b->npages) || ((uint32_t)m->num_of_vs > m->npages * GPU_PAGE_VERTICES))
+        {
+            return (false);
+        }
+        for (uint32_t page = m->first_page; page < m->first_page + m->npages; page++)
+        {
+            if ((b->owners[page] != c) || (b->offsets[4 * page + 0] != c->x * CHUNK_DIM) ||
+                (b->offsets[4 * page + 1] != c->y * CHUNK_DIM) || (b->offsets[4 * page + 2] != c->z * CHUNK_DIM))
             {
-                break;
+                return (false);
             }
         }
-
-        assert(block_type != BLOCK_AIR);
-        ranges[ranges_count++] = { block_type, start_x, start_y, start_z, end_x, end_y, end_z };
+        slot_pages += m->npages;
+    }
+
+    return ((owned_pages == b->used_pages) && (slot_pages == b->used_pages));
+}
+
+void chunk_delete_mesh(Gpu_buffer *buffers, Chunk *c)
+{
+    Mesh *m = &c->mesh;
+    if (m->npages != 0)
+    {
+        gpu_buffer_free(&buffers[m->format], m->first_page, m->npages);
+        m->num_of_vs = 0;
+        m->first_page = 0;
+        m->npages = 0;
+    }
+}
+
+// NOTE(max): the slot is kept when the new mesh fits in it, pages it no longer needs are given back
+void chunk_upload_mesh(Gpu_buffer *buffers, Chunk *c, Chunk_mesh_data *mesh_data)
+{
+    Mesh *m = &c->mesh;
+
+    // NOTE(max): all faces can be hidden, delete the mesh then
+    if (mesh_data->num_of_vs == 0)
+    {
+        chunk_delete_mesh(buffers, c);
+        return;
+    }
+
+    uint32_t npages = gpu_pages_for(mesh_data->num_of_vs);
+    if ((m->npages != 0) && ((m->format != mesh_data->format) || (m->npages < npages)))
+    {
+        chunk_delete_mesh(buffers, c);
+    }
+
+    Gpu_buffer *b = &buffers[mesh_data->format];
+    if (m->npages == 0)
+    {
+        if (!gpu_buffer_alloc(b, npages, &m->first_page))
+        {
+            return;
+        }
+        m->npages = npages;
+        m->format = mesh_data->format;
+        gpu_buffer_set_owner(b, c);
+    }
+    else if (m->npages > npages)
+    {
+        gpu_buffer_free(b, m->first_page + npages, m->npages - npages);
+        m->npages = npages;
     }
+    m->num_of_vs = mesh_data->num_of_vs;
 
-    assert(count == 0);
-    *num_of_ranges = ranges_count;
+    glBindBuffer(GL_ARRAY_BUFFER, b->vbo);
+    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)m->first_page * GPU_PAGE_VERTICES * b->vertex_size,
+                    (GLsizeiptr)m->num_of_vs * b->vertex_size, mesh_data->vs);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void game_state_and_memory_init(Game_memory *memory)
+inline int stream_offset_distance_sq(const Stream_offset &o)
 {
-    assert(!memory->is_initialized);
+    return (o.x * o.x + o.y * o.y + o.z * o.z);
+}
 
-    assert(sizeof(Game_state) <= memory->permanent_mem_size);
-    Game_state *state = (Game_state *)memory->permanent_mem;
+bool streamer_init(Streamer *streamer, Memory_arena *arena)
+{
+    streamer->radius = DEFAULT_STREAM_RADIUS;
+    streamer->generating = 0;
+    streamer->complete = false;
+    streamer->stats = {};
+
+    int side = 2 * STREAM_MAX_RADIUS + 1;
+    streamer->noffsets = side * side * (2 * STREAM_RADIUS_Y + 1);
+    streamer->offsets = (Stream_offset *)memory_arena_alloc(arena, streamer->noffsets * sizeof(Stream_offset));
+    if (!streamer->offsets)
+    {
+        return (false);
+    }
 
-    memory->is_initialized = 1;
+    int n = 0;
+    for (int y = -STREAM_RADIUS_Y; y <= STREAM_RADIUS_Y; y++)
+    {
+        for (int z = -STREAM_MAX_RADIUS; z <= STREAM_MAX_RADIUS; z++)
+        {
+            for (int x = -STREAM_MAX_RADIUS; x <= STREAM_MAX_RADIUS; x++)
+            {
+                streamer->offsets[n].x = (int8_t)x;
+                streamer->offsets[n].y = (int8_t)y;
+                streamer->offsets[n].z = (int8_t)z;
+                n++;
+            }
+        }
+    }
+
+    std::sort(streamer->offsets, streamer->offsets + n, [](const Stream_offset &a, const Stream_offset &b) {
+        return (stream_offset_distance_sq(a) < stream_offset_distance_sq(b));
+    });
+
+    return (true);
+}
+
+// NOTE(max): threads, the transient memory and GL objects, none of them survive a snapshot of the permanent memory.
+// False if the transient memory runs out.
+bool game_init_runtime(Game_memory *memory, Game_state *state)
+{
+    state->mesher_mode = (Mesher_mode)memory->mesher_mode;
+    state->vertex_format = (Vertex_format)memory->vertex_format;
+    state->rebuild_budget_us = memory->rebuild_budget_us;
+    state->streamer.radius = memory->stream_radius;
 
     float cubeVertices[] = {
         // positions          
@@ -615,67 +6161,27 @@ void game_state_and_memory_init(Game_memory *memory)
         -1.0f,  1.0f,  0.0f
 	};
 
-    state->arena.curr = (uint8_t *)ALIGN_PTR_UP(&state[1], 8);
-    state->arena.end = (uint8_t *)memory->permanent_mem + memory->permanent_mem_size;
-
-    state->world.next = 0;
-    state->world.rebuild_stack_top = 0;
+    // NOTE(max): leave one core to the main thread, it only runs jobs while it waits for them
+    new (&state->job_system) Job_system();
+    job_system_init(&state->job_system, std::max((int)std::thread::hardware_concurrency(), 2));
 
+    // NOTE(max): mesh jobs and the CPU side of the chunk buffers live for the whole run, they take the front of the
+    // transient memory and the rest of it is the frame arena
+    Memory_arena transient_arena;
+    memory_arena_init_reserved(&transient_arena, memory->transient_mem, memory->transient_mem_size, memory->huge_pages);
+    new (&state->mesh_pool) Mesh_pool();
+    if (!mesh_pool_init(&state->mesh_pool, &state->job_system, &transient_arena))
     {
-        int r = 3;
-        assert((r+r+1)*(r+r+1) <= REBUILD_STACK_SIZE);
-
-        for (int z = -r; z <= r; z++)
+        return (false);
+    }
+    for (int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+    {
+        if (!gpu_buffer_init(&state->chunk_buffers[i], (Vertex_format)i, &transient_arena))
         {
-            for (int x = -r; x <= r; x++)
-            {
-                Chunk *c = world_add_chunk(&state->world, &state->arena, x, 0, z);
-                assert(c);
-
-                int i = 0;
-                for (int y = 0; y < 8; y++)
-                {
-                    for (int z = 0; z < CHUNK_DIM; z++)
-                    {
-                        for (int x = 0; x < CHUNK_DIM; x++)
-                        {
-                            uint8_t block_type;
-                            if (y < 2)
-                                block_type = BLOCK_STONE;
-                            else if (y < 4)
-                                block_type = BLOCK_DIRT;
-                            else if (y < 6)
-                                block_type = BLOCK_GRASS;
-                            else
-                                block_type = BLOCK_STONE;
-
-                            c->blocks[CHUNK_DIM * CHUNK_DIM * y + CHUNK_DIM * z + x] = block_type;
-                            c->nblocks++;
-                            i++;
-                        }
-                    }
-                }
-                world_push_chunk_for_rebuild(&state->world, c);
-            }
+            return (false);
         }
     }
-
-    state->cam_pos = Vec3f(0, 20, 0);
-    state->cam_up = Vec3f(0, 1, 0);
-
-    state->cam_rot.pitch = 0.0f;
-    state->cam_rot.roll = 0.0f;
-    state->cam_rot.yaw = -90.0f;
-
-    state->cam_view_dir.x = cosf(TO_RADIANS(state->cam_rot.yaw)) * cosf(TO_RADIANS(state->cam_rot.pitch));
-    state->cam_view_dir.y = sinf(TO_RADIANS(state->cam_rot.pitch));
-    state->cam_view_dir.z = sinf(TO_RADIANS(state->cam_rot.yaw)) * cosf(TO_RADIANS(state->cam_rot.pitch));
-
-    state->cam_move_dir.x = state->cam_view_dir.x;
-    state->cam_move_dir.y = 0.0f;
-    state->cam_move_dir.z = state->cam_view_dir.z;
-
-    state->block_to_place = BLOCK_GRASS;
+    state->frame_arena = transient_arena;
 
     // NOTE(max): call constructors on existing memory
     new (&state->mesh_sp) ShaderProgram("mesh");
@@ -684,10 +6190,13 @@ void game_state_and_memory_init(Game_memory *memory)
 	new (&state->imageSP) ShaderProgram("image");
 	new (&state->inventoryBlockSP) ShaderProgram("inventoryBlock");
 	new (&state->meshShadowMapSP) ShaderProgram("meshShadowMap");
-	new (&state->shadowMap1) ShadowMap(2048, 2048);
-	new (&state->shadowMap2) ShadowMap(2048, 2048);
-	new (&state->shadowMap3) ShadowMap(2048, 2048);
-	new (&state->shadowMap4) ShadowMap(2048, 2048);
+	state->mesh_sp.use();
+	glUniform3fv(glGetUniformLocation(state->mesh_sp.get(), "u_block_colors"), BLOCK_TYPE_COUNT, &Block_colors[0].x);
+	glUseProgram(0);
+	new (&state->shadowMap1) ShadowMap(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+	new (&state->shadowMap2) ShadowMap(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+	new (&state->shadowMap3) ShadowMap(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
+	new (&state->shadowMap4) ShadowMap(SHADOW_MAP_SIZE, SHADOW_MAP_SIZE);
 	new (&state->sunTexture) Texture("Images/sun.png", GL_RGBA);
 	new (&state->inventoryBarTexture) Texture("Images/inventoryBar.png");
 	new (&state->crossTexture) Texture("Images/cross.png");
@@ -714,38 +6223,593 @@ void game_state_and_memory_init(Game_memory *memory)
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
     glBindVertexArray(0);
+
+    return (true);
+}
+
+// NOTE(max): false if the permanent or the transient memory runs out
+bool game_state_and_memory_init(Game_memory *memory)
+{
+    assert(!memory->is_initialized);
+
+    // NOTE(max): Game_state is the first thing in the permanent memory, the rest of it is state->arena
+    Memory_arena permanent_arena;
+    memory_arena_init_reserved(&permanent_arena, memory->permanent_mem, memory->permanent_mem_size, memory->huge_pages);
+    Game_state *state = (Game_state *)memory_arena_alloc(&permanent_arena, sizeof(Game_state));
+    assert(state == memory->permanent_mem);
+
+    memory->is_initialized = 1;
+
+    state->arena = permanent_arena;
+
+    if (!world_init(&state->world, &state->arena))
+    {
+        return (false);
+    }
+
+    // NOTE(max): start a few blocks above the ground
+    state->terrain_seed = memory->terrain_seed;
+    if (!light_init(&state->light, &state->world, &state->arena, state->terrain_seed))
+    {
+        return (false);
+    }
+    state->cam_pos = Vec3f(0.5f, (float)(terrain_height(state->terrain_seed, 0, 0) + 4), 0.5f);
+    state->cam_up = Vec3f(0, 1, 0);
+
+    state->cam_rot.pitch = 0.0f;
+    state->cam_rot.roll = 0.0f;
+    state->cam_rot.yaw = -90.0f;
+
+    state->cam_view_dir.x = cosf(TO_RADIANS(state->cam_rot.yaw)) * cosf(TO_RADIANS(state->cam_rot.pitch));
+    state->cam_view_dir.y = sinf(TO_RADIANS(state->cam_rot.pitch));
+    state->cam_view_dir.z = sinf(TO_RADIANS(state->cam_rot.yaw)) * cosf(TO_RADIANS(state->cam_rot.pitch));
+
+    state->cam_move_dir.x = state->cam_view_dir.x;
+    state->cam_move_dir.y = 0.0f;
+    state->cam_move_dir.z = state->cam_view_dir.z;
+
+    state->block_to_place = BLOCK_GRASS;
+
+    if (!streamer_init(&state->streamer, &state->arena))
+    {
+        return (false);
+    }
+    if (!region_cache_init(&state->regions, &state->arena, memory->world_dir))
+    {
+        return (false);
+    }
+
+    return (game_init_runtime(memory, state));
+}
+
+// NOTE(max): min corners of the chunks that have a mesh, SoA and padded to a multiple of 4 for the SSE test
+struct Chunk_bounds
+{
+    int count;
+    float *min_x;
+    float *min_y;
+    float *min_z;
+    Chunk **chunks;
+};
+
+bool chunk_bounds_build(World *world, Memory_arena *arena, Chunk_bounds *out)
+{
+    int count = 0;
+    for (Chunk *c = world->next; c != 0; c = c->next)
+    {
+        count += (c->nblocks && c->mesh.num_of_vs);
+    }
+
+    int padded = ALIGN_UP(count, 4) + 4;
+    out->count  = 0;
+    out->min_x  = (float *)memory_arena_alloc(arena, padded * sizeof(float));
+    out->min_y  = (float *)memory_arena_alloc(arena, padded * sizeof(float));
+    out->min_z  = (float *)memory_arena_alloc(arena, padded * sizeof(float));
+    out->chunks = (Chunk **)memory_arena_alloc(arena, padded * sizeof(Chunk *));
+    if (!out->min_x || !out->min_y || !out->min_z || !out->chunks)
+    {
+        return (false);
+    }
+
+    for (Chunk *c = world->next; c != 0; c = c->next)
+    {
+        if (c->nblocks && c->mesh.num_of_vs)
+        {
+            out->min_x[out->count] = (float)(c->x * CHUNK_DIM);
+            out->min_y[out->count] = (float)(c->y * CHUNK_DIM);
+            out->min_z[out->count] = (float)(c->z * CHUNK_DIM);
+            out->chunks[out->count] = c;
+            out->count++;
+        }
+    }
+
+    for (int i = out->count; i < padded; i++)
+    {
+        out->min_x[i] = out->min_y[i] = out->min_z[i] = 0.0f;
+        out->chunks[i] = 0;
+    }
+
+    return (true);
+}
+
+// NOTE(max): writes chunks whose box touches the frustum to visible, returns their number.
+// All chunks have the same size, so the corner furthest along each plane normal is min + a per-plane offset
+// and the test is three multiply-adds per plane for four chunks at once.
+int frustum_cull_chunks(Frustum *f, Chunk_bounds *bounds, Chunk **visible)
+{
+    __m128 plane_a[6], plane_b[6], plane_c[6], plane_d[6];
+    for (int p = 0; p < 6; p++)
+    {
+        float a = f->planes[p][0];
+        float b = f->planes[p][1];
+        float c = f->planes[p][2];
+        float d = f->planes[p][3];
+        d += (a > 0.0f ? a : 0.0f) * CHUNK_DIM;
+        d += (b > 0.0f ? b : 0.0f) * CHUNK_DIM;
+        d += (c > 0.0f ? c : 0.0f) * CHUNK_DIM;
+
+        plane_a[p] = _mm_set1_ps(a);
+        plane_b[p] = _mm_set1_ps(b);
+        plane_c[p] = _mm_set1_ps(c);
+        plane_d[p] = _mm_set1_ps(d);
+    }
+
+    __m128 zero = _mm_setzero_ps();
+    int nvisible = 0;
+    for (int i = 0; i < bounds->count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(bounds->min_x + i);
+        __m128 y = _mm_loadu_ps(bounds->min_y + i);
+        __m128 z = _mm_loadu_ps(bounds->min_z + i);
+
+        int inside = 0xF;
+        for (int p = 0; (p < 6) && inside; p++)
+        {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(plane_a[p], x), _mm_mul_ps(plane_b[p], y)),
+                                     _mm_add_ps(_mm_mul_ps(plane_c[p], z), plane_d[p]));
+            inside &= _mm_movemask_ps(_mm_cmpge_ps(dist, zero));
+        }
+
+        for (int lane = 0; (lane < 4) && (i + lane < bounds->count); lane++)
+        {
+            if (inside & (1 << lane))
+            {
+                visible[nvisible++] = bounds->chunks[i + lane];
+            }
+        }
+    }
+
+    return (nvisible);
+}
+
+struct Cave_node
+{
+    Chunk *c;
+    // NOTE(max): face of c the search came in through, -1 for the camera chunk
+    int entry;
+    // NOTE(max): one bit per Face the search stepped along on the way here
+    int dirs;
+};
+
+// NOTE(max): breadth first search from the chunk of the camera through the chunks in the frustum. The search
+// leaves a chunk only through faces that air links to the face it came in through, and it never steps against a
+// direction it already went, so it keeps moving away from the camera. Chunks behind solid rock are not reached.
+// Stamps frame on the chunks it reaches and returns their number, -1 when the camera chunk is not loaded.
+int cave_cull_chunks(World *world, Vec3f cam_pos, Frustum *frustum, uint32_t frame, Memory_arena *scratch)
+{
+    Chunk *start = world_find_chunk(world, (int)floorf(cam_pos.x / CHUNK_DIM), (int)floorf(cam_pos.y / CHUNK_DIM),
+                                     (int)floorf(cam_pos.z / CHUNK_DIM));
+    if (!start)
+    {
+        return (-1);
+    }
+
+    void *cursor = memory_arena_get_cursor(scratch);
+    Cave_node *queue = (Cave_node *)memory_arena_alloc(scratch, world->nchunks * sizeof(Cave_node));
+    if (!queue)
+    {
+        return (-1);
+    }
+
+    int head = 0;
+    int tail = 0;
+    start->cave_frame = frame;
+    queue[tail++] = { start, -1, 0 };
+    while (head < tail)
+    {
+        Cave_node node = queue[head++];
+        for (int f = 0; f < FACE_COUNT; f++)
+        {
+            if ((node.dirs & (1 << face_opposite(f))) ||
+                ((node.entry >= 0) && !face_links_connected(node.c->face_links, node.entry, f)))
+            {
+                continue;
+            }
+
+            Chunk *n = node.c->neighbours[f];
+            if (!n || (n->cave_frame == frame) || !frustum_test_chunk(frustum, n->x, n->y, n->z))
+            {
+                continue;
+            }
+
+            n->cave_frame = frame;
+            assert(tail < world->nchunks);
+            queue[tail++] = { n, face_opposite(f), node.dirs | (1 << f) };
+        }
+    }
+
+    memory_arena_set_cursor(scratch, cursor);
+    return (tail);
 }
 
-void renderWorld(Game_state *state, ShaderProgram &sp) {
-	Chunk *c = state->world.next;
-	while (c != 0)
+// NOTE(max): chunks meshed before a vertex format switch keep the old format until they are rebuilt, so there is
+// one glMultiDrawArrays for every format that is in use
+void renderWorld(Game_state *state, ShaderProgram &sp, Chunk **chunks, int nchunks) {
+	void *cursor = memory_arena_get_cursor(&state->frame_arena);
+	GLint *firsts = (GLint *)memory_arena_alloc(&state->frame_arena, (nchunks + 1) * sizeof(GLint));
+	GLsizei *counts = (GLsizei *)memory_arena_alloc(&state->frame_arena, (nchunks + 1) * sizeof(GLsizei));
+	if (!firsts || !counts) {
+		memory_arena_set_cursor(&state->frame_arena, cursor);
+		return;
+	}
+
+	Mat4x4f model = mat4x4f_identity();
+	glUniformMatrix4fv(glGetUniformLocation(sp.get(), "u_model"), 1, GL_FALSE, &model.m[0][0]);
+	glUniform1i(glGetUniformLocation(sp.get(), "u_use_block_colors"), 1);
+	glUniform1i(glGetUniformLocation(sp.get(), "u_use_page_offsets"), 1);
+	glUniform1i(glGetUniformLocation(sp.get(), "u_page_offsets"), GPU_PAGE_OFFSETS_UNIT);
+	GLint packed_vertices_location = glGetUniformLocation(sp.get(), "u_packed_vertices");
+
+	for (int format = 0; format < VERTEX_FORMAT_COUNT; format++)
 	{
-		if (c->nblocks)
+		Gpu_buffer *b = &state->chunk_buffers[format];
+		int ndraws = 0;
+		for (int i = 0; i < nchunks; i++)
 		{
-			Vec3f chunk_offset(
-				(float)(c->x * CHUNK_DIM),
-				(float)(c->y * CHUNK_DIM),
-				(float)(c->z * CHUNK_DIM));
+			Mesh *mesh = &chunks[i]->mesh;
+			if ((mesh->format == format) && mesh->npages)
+			{
+				firsts[ndraws] = (GLint)(mesh->first_page * GPU_PAGE_VERTICES);
+				counts[ndraws] = mesh->num_of_vs;
+				ndraws++;
+			}
+		}
+		if (ndraws == 0)
+			continue;
+
+		glUniform1i(packed_vertices_location, format == VERTEX_FORMAT_PACKED);
+		glActiveTexture(GL_TEXTURE0 + GPU_PAGE_OFFSETS_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, b->offsets_texture);
+		glBindVertexArray(b->vao);
+		glMultiDrawArrays(GL_TRIANGLES, firsts, counts, ndraws);
+		state->render_stats.draw_calls++;
+	}
+	glBindVertexArray(0);
+	glActiveTexture(GL_TEXTURE0);
 
-			Mat4x4f model = mat4x4f_identity();
-			model = mat4x4f_translate(model, chunk_offset);
-			sp.setMatrix4fv("u_model", &model.m[0][0]);
+	memory_arena_set_cursor(&state->frame_arena, cursor);
+}
 
-			for (int m_idx = 0; m_idx < BLOCK_TYPE_COUNT; m_idx++)
-			{
-				Mesh *mesh = &c->meshes[m_idx];
-				if (mesh->num_of_vs)
-				{
-					Vec3f mesh_color = Block_colors[m_idx];
-					glUniform3f(glGetUniformLocation(sp.get(), "u_color"), mesh_color.r, mesh_color.g, mesh_color.b);
-					glBindVertexArray(mesh->vao);
-					glDrawArrays(GL_TRIANGLES, 0, mesh->num_of_vs);
-					glBindVertexArray(0);
-				}
+// NOTE(max): draws the chunks of bounds that are inside projectionView and counts them for the pass. The camera
+// pass also skips chunks cave_cull_chunks cannot reach, the shadow passes look from the sun and keep them.
+void renderVisibleWorld(Game_state *state, ShaderProgram &sp, Chunk_bounds *bounds, const glm::mat4 &projectionView, Render_pass pass) {
+	void *cursor = memory_arena_get_cursor(&state->frame_arena);
+	Chunk **visible = (Chunk **)memory_arena_alloc(&state->frame_arena, (bounds->count + 1) * sizeof(Chunk *));
+	// NOTE(max): out of frame memory the pass draws nothing
+	if (!visible) {
+		state->render_stats.culled[pass] = 0;
+		state->render_stats.drawn[pass] = 0;
+		return;
+	}
+
+	Frustum frustum;
+	frustum_from_matrix(&frustum, projectionView);
+	int nvisible = frustum_cull_chunks(&frustum, bounds, visible);
+	state->render_stats.culled[pass] = bounds->count - nvisible;
+
+	if (pass == RENDER_PASS_CAMERA) {
+		uint32_t frame = ++state->cave_frame;
+		int reachable = cave_cull_chunks(&state->world, state->cam_pos, &frustum, frame, &state->frame_arena);
+		int nreachable = nvisible;
+		if (reachable >= 0) {
+			nreachable = 0;
+			for (int i = 0; i < nvisible; i++) {
+				if (visible[i]->cave_frame == frame)
+					visible[nreachable++] = visible[i];
 			}
 		}
-		c = c->next;
+
+		state->render_stats.occluded = nvisible - nreachable;
+		state->render_stats.cave_reachable = reachable;
+		state->render_stats.loaded = state->world.nchunks;
+		nvisible = nreachable;
+	}
+
+	state->render_stats.drawn[pass] = nvisible;
+
+	renderWorld(state, sp, visible, nvisible);
+	memory_arena_set_cursor(&state->frame_arena, cursor);
+}
+
+// NOTE(max): the cached maps of cascades that can see the chunk are stale now
+void shadow_cascades_chunk_changed(Game_state *state, Chunk *c)
+{
+	for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+	{
+		Shadow_cascade *cascade = &state->shadow_cascades[i];
+		if (cascade->valid && frustum_test_chunk(&cascade->frustum, c->x, c->y, c->z))
+		{
+			cascade->dirty = true;
+		}
+	}
+}
+
+// NOTE(max): picking, placement and the highlight all want the block under the crosshair. The cached ray is
+// dropped when the camera moves at the start of the frame and when blocks or chunks change under it.
+Raycast_result *game_camera_ray(Game_state *state)
+{
+    if (!state->camera_ray_valid)
+    {
+        state->camera_ray = raycast(&state->world, state->cam_pos, state->cam_view_dir, RAYCAST_PICK_DISTANCE);
+        state->camera_ray_valid = true;
+    }
+    return (&state->camera_ray);
+}
+
+// NOTE(max): every edit goes through here, c has to be generated
+bool game_set_block(Game_state *state, Chunk *c, int x, int y, int z, uint8_t type)
+{
+    uint8_t old_type = chunk_get_block(c, x, y, z);
+    if (!chunk_set_block(&state->world.block_storage, c, x, y, z, type))
+    {
+        return (false);
+    }
+
+    c->modified = true;
+    world_push_chunk_for_rebuild(&state->world, &state->arena, c);
+    world_push_neighbours_for_rebuild(&state->world, &state->arena, c, x, y, z);
+    light_block_changed(&state->light, c, x, y, z, old_type);
+    state->camera_ray_valid = false;
+    return (true);
+}
+
+// NOTE(max): frees the GL mesh and gives the slot back to the chunk pool, handles to the chunk go stale
+void game_remove_chunk(Game_state *state, Chunk *c)
+{
+	chunk_delete_mesh(state->chunk_buffers, c);
+	shadow_cascades_chunk_changed(state, c);
+	world_remove_chunk(&state->world, c);
+	state->camera_ray_valid = false;
+}
+
+// NOTE(max): the chunk gets its terrain and light, it and its neighbours have to be meshed again. Without block
+// storage for it the chunk is removed and the streamer brings it in again later.
+void game_finish_generated_chunk(Game_state *state, Chunk *c, uint8_t *blocks)
+{
+    if (!chunk_set_all_blocks(&state->world.block_storage, c, blocks))
+    {
+        game_remove_chunk(state, c);
+        state->streamer.complete = false;
+        return;
+    }
+    c->generated = true;
+    light_chunk_init(&state->light, c);
+    state->camera_ray_valid = false;
+
+    world_push_chunk_for_rebuild(&state->world, &state->arena, c);
+    for (int f = 0; f < FACE_COUNT; f++)
+    {
+        Chunk *n = c->neighbours[f];
+        if (n && n->nblocks)
+        {
+            world_push_chunk_for_rebuild(&state->world, &state->arena, n);
+        }
+    }
+
+    state->streamer.stats.loaded++;
+    state->streamer.stats.loaded_total++;
+}
+
+// NOTE(max): false if the region write failed, the chunk stays modified then
+bool game_save_chunk(Game_state *state, Chunk *c)
+{
+    void *cursor = memory_arena_get_cursor(&state->frame_arena);
+    uint8_t *blocks = (uint8_t *)memory_arena_alloc(&state->frame_arena, BLOCKS_IN_CHUNK);
+    if (!blocks)
+    {
+        return (false);
+    }
+    chunk_copy_blocks(c, blocks);
+    if (region_write_chunk(&state->regions, c->x, c->y, c->z, blocks))
+    {
+        c->modified = false;
+    }
+    memory_arena_set_cursor(&state->frame_arena, cursor);
+    return (!c->modified);
+}
+
+// NOTE(max): unloads far chunks, saving the edited ones, and brings in missing near ones. Edited chunks that could
+// not be saved stay loaded and are tried again next frame. Saved chunks are read from their region right away, the
+// others are generated and picked up with the mesh results.
+void game_stream_world(Game_state *state)
+{
+    Streamer *streamer = &state->streamer;
+    Mesh_pool *pool = &state->mesh_pool;
+    World *world = &state->world;
+
+    int cam_x = (int)floorf(state->cam_pos.x) >> CHUNK_DIM_LOG2;
+    int cam_y = (int)floorf(state->cam_pos.y) >> CHUNK_DIM_LOG2;
+    int cam_z = (int)floorf(state->cam_pos.z) >> CHUNK_DIM_LOG2;
+    int radius = std::min(std::max(streamer->radius, 0), STREAM_MAX_RADIUS);
+
+    streamer->stats.loaded = 0;
+    streamer->stats.unloaded = 0;
+
+    int unload_radius = radius + STREAM_UNLOAD_MARGIN;
+    int unload_radius_y = STREAM_RADIUS_Y + STREAM_UNLOAD_MARGIN;
+    Chunk *c = world->next;
+    while ((c != 0) && (streamer->stats.unloaded < STREAM_MAX_UNLOADS_PER_FRAME))
+    {
+        Chunk *next = c->next;
+        if ((abs(c->x - cam_x) > unload_radius) || (abs(c->z - cam_z) > unload_radius) ||
+            (abs(c->y - cam_y) > unload_radius_y))
+        {
+            if (!c->modified || game_save_chunk(state, c))
+            {
+                game_remove_chunk(state, c);
+                streamer->stats.unloaded++;
+            }
+        }
+        c = next;
+    }
+    streamer->stats.unloaded_total += streamer->stats.unloaded;
+
+    if (streamer->complete && (streamer->complete_x == cam_x) && (streamer->complete_y == cam_y) &&
+        (streamer->complete_z == cam_z))
+    {
+        return;
+    }
+
+    // NOTE(max): without frame memory for the blocks nothing is loaded this frame
+    void *cursor = memory_arena_get_cursor(&state->frame_arena);
+    uint8_t *blocks = (uint8_t *)memory_arena_alloc(&state->frame_arena, BLOCKS_IN_CHUNK);
+    if (!blocks)
+    {
+        return;
+    }
+    int disk_loads = 0;
+
+    bool complete = true;
+    for (int i = 0; i < streamer->noffsets; i++)
+    {
+        Stream_offset o = streamer->offsets[i];
+        if ((abs(o.x) > radius) || (abs(o.z) > radius))
+        {
+            continue;
+        }
+
+        int x = cam_x + o.x;
+        int y = cam_y + o.y;
+        int z = cam_z + o.z;
+        if (world_find_chunk(world, x, y, z))
+        {
+            continue;
+        }
+
+        // NOTE(max): a saved chunk that can not be read is generated again, its next save replaces the broken copy
+        complete = false;
+        if (region_has_chunk(&state->regions, x, y, z))
+        {
+            if (disk_loads == STREAM_MAX_DISK_LOADS_PER_FRAME)
+            {
+                break;
+            }
+
+            disk_loads++;
+            if (region_read_chunk(&state->regions, x, y, z, blocks))
+            {
+                Chunk *added = world_add_chunk(world, &state->arena, x, y, z);
+                if (!added)
+                {
+                    break;
+                }
+                game_finish_generated_chunk(state, added, blocks);
+                streamer->stats.loaded_from_disk++;
+                continue;
+            }
+        }
+
+        if ((pool->nfree == 0) || (streamer->generating >= STREAM_MAX_GENERATE_JOBS))
+        {
+            break;
+        }
+
+        Chunk *added = world_add_chunk(world, &state->arena, x, y, z);
+        if (!added)
+        {
+            break;
+        }
+
+        mesh_pool_submit_generate(pool, added, state->terrain_seed);
+        streamer->generating++;
+    }
+    memory_arena_set_cursor(&state->frame_arena, cursor);
+
+    streamer->complete = complete;
+    streamer->complete_x = cam_x;
+    streamer->complete_y = cam_y;
+    streamer->complete_z = cam_z;
+}
+
+void game_print_stats(Game_memory *memory, Game_state *state)
+{
+	printf("permanent: used %llu KB, high water %llu KB, committed %llu KB\n",
+		(unsigned long long)(((uint8_t *)state->arena.curr - (uint8_t *)memory->permanent_mem) / 1024),
+		(unsigned long long)(((uint8_t *)state->arena.high_water - (uint8_t *)memory->permanent_mem) / 1024),
+		(unsigned long long)(memory_arena_committed_size(&state->arena, memory->permanent_mem) / 1024));
+	printf("transient: high water %llu KB, committed %llu KB\n",
+		(unsigned long long)(((uint8_t *)state->frame_arena.high_water - (uint8_t *)memory->transient_mem) / 1024),
+		(unsigned long long)(memory_arena_committed_size(&state->frame_arena, memory->transient_mem) / 1024));
+	printf("chunks: %d, pool slots %u, queued for rebuild %d, block storage %llu KB\n", state->world.nchunks,
+		state->world.pool.nslots, state->world.rebuild_queue_count,
+		(unsigned long long)(state->world.block_storage.bytes_in_use / 1024));
+
+	Stream_stats *stream_stats = &state->streamer.stats;
+	printf("streaming: radius %d, resident %d, generating %d, last frame +%d -%d, total +%llu -%llu, avg generate %.1f us\n",
+		state->streamer.radius, state->world.nchunks, state->streamer.generating, stream_stats->loaded,
+		stream_stats->unloaded, (unsigned long long)stream_stats->loaded_total,
+		(unsigned long long)stream_stats->unloaded_total,
+		stream_stats->generate_us_total / std::max(stream_stats->loaded_total, (uint64_t)1));
+
+	Region_stats *region_stats = &state->regions.stats;
+	printf("regions: %llu from disk, %llu read, %llu written (%.1f KB), %llu compactions\n",
+		(unsigned long long)stream_stats->loaded_from_disk, (unsigned long long)region_stats->chunks_read,
+		(unsigned long long)region_stats->chunks_written, region_stats->bytes_written / 1024.0,
+		(unsigned long long)region_stats->compactions);
+
+	Job_system *job_system = &state->job_system;
+	printf("jobs: %d threads, %llu run, %llu stolen, %d queued\n", job_system->nthreads,
+		(unsigned long long)job_system->executed.load(), (unsigned long long)job_system->stolen.load(),
+		job_system->queued.load());
+
+	Rebuild_stats *rebuild_stats = &state->rebuild_stats;
+	uint64_t meshed = std::max(rebuild_stats->chunks_meshed, (uint64_t)1);
+	uint64_t uploaded = std::max(rebuild_stats->chunks_uploaded, (uint64_t)1);
+	printf("rebuilds: budget %.0f us, last frame %.0f us (%d uploads, %d submits)\n", state->rebuild_budget_us,
+		rebuild_stats->frame_us, rebuild_stats->uploads, rebuild_stats->submits);
+	printf("  %llu meshed, avg mesh %.1f us, avg upload %.1f us, last time to clean %.1f ms%s\n",
+		(unsigned long long)rebuild_stats->chunks_meshed, rebuild_stats->mesh_us_total / meshed,
+		rebuild_stats->upload_us_total / uploaded, rebuild_stats->last_time_to_clean_ms,
+		rebuild_stats->cleaning ? " (rebuilding)" : "");
+	for (int i = 0; i < RENDER_PASS_COUNT; i++)
+	{
+		printf("  %-8s drawn %5d culled %5d%s\n", Render_pass_names[i],
+			state->render_stats.drawn[i], state->render_stats.culled[i],
+			state->render_stats.cached[i] ? " (cached)" : "");
+	}
+	printf("shadow cascade updates: %llu\n", (unsigned long long)state->render_stats.shadow_updates);
+	printf("draw calls: %d\n", state->render_stats.draw_calls);
+	for (int i = 0; i < VERTEX_FORMAT_COUNT; i++)
+	{
+		Gpu_buffer *b = &state->chunk_buffers[i];
+		printf("  %-6s buffer: %u of %u pages used (%u KB), %d free ranges, %llu grows, %llu compactions (%llu pages moved), %llu failed, pages %s\n",
+			(i == VERTEX_FORMAT_PACKED) ? "packed" : "float", b->used_pages, b->npages,
+			(unsigned)((uint64_t)b->npages * GPU_PAGE_VERTICES * b->vertex_size / 1024), b->nfree,
+			(unsigned long long)b->stats.grows, (unsigned long long)b->stats.compactions,
+			(unsigned long long)b->stats.pages_moved, (unsigned long long)b->stats.failed,
+			gpu_buffer_valid(b, &state->world) ? "valid" : "INVALID");
 	}
+	if (state->render_stats.cave_reachable >= 0)
+		printf("cave culling: %d of %d loaded chunks reachable, %d chunks in view occluded\n",
+			state->render_stats.cave_reachable, state->render_stats.loaded, state->render_stats.occluded);
+	else
+		printf("cave culling: off, the camera chunk is not loaded\n");
+
+	Light_stats *light_stats = &state->light.stats;
+	printf("light: %llu chunks lit, %llu edits, %llu nodes added, %llu removed, %llu dropped, %.1f ms total\n",
+		(unsigned long long)light_stats->chunks_lit, (unsigned long long)light_stats->edits,
+		(unsigned long long)light_stats->nodes_added, (unsigned long long)light_stats->nodes_removed,
+		(unsigned long long)light_stats->dropped, light_stats->time_us / 1e3);
 }
 
 void game_update_and_render(Game_input *input, Game_memory *memory)
@@ -753,8 +6817,15 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
     assert(memory->is_initialized);
     Game_state *state = (Game_state *)memory->permanent_mem;
 
+    void *frame_start = memory_arena_get_cursor(&state->frame_arena);
+
     /* logic update */
     {
+        if (input->enter.is_pressed && !input->enter.was_pressed)
+        {
+            game_print_stats(memory, state);
+        }
+
         state->cam_rot.pitch += input->mouse_dy;
         state->cam_rot.yaw += input->mouse_dx;
 
@@ -777,6 +6848,7 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
         move_dir = state->cam_view_dir;
         move_dir.y = 0.0f;
         state->cam_move_dir = normalize(move_dir);
+        state->camera_ray_valid = false;
 
         float cam_speed = 10.0f * input->dt;
         if (input->w.is_pressed)
@@ -823,11 +6895,15 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
         {
             state->block_to_place = BLOCK_SNOW;
         }
+        if (input->n5.is_pressed)
+        {
+            state->block_to_place = BLOCK_LAMP;
+        }
 
         // block removal
         if (input->mleft.is_pressed)
         {
-            Raycast_result rc = raycast(&state->world, state->cam_pos, state->cam_view_dir);
+            Raycast_result rc = *game_camera_ray(state);
             if (rc.collision == true)
             {
                 int mask = ~((~1) << (CHUNK_DIM_LOG2 - 1));
@@ -835,12 +6911,9 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
                 int block_y = rc.j & mask;
                 int block_z = rc.k & mask;
 
-                int block_idx = CHUNK_DIM * CHUNK_DIM * block_y + CHUNK_DIM * block_z + block_x;
-                if (rc.chunk->blocks[block_idx] != BLOCK_AIR)
+                if (chunk_is_solid(rc.chunk, block_x, block_y, block_z))
                 {
-                    rc.chunk->blocks[block_idx] = BLOCK_AIR;
-                    rc.chunk->nblocks--;
-                    world_push_chunk_for_rebuild(&state->world, rc.chunk);
+                    game_set_block(state, rc.chunk, block_x, block_y, block_z, BLOCK_AIR);
                 }
             }
         }
@@ -848,311 +6921,114 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
         // block placement
         if (input->mright.is_pressed && !input->mright.was_pressed)
         {
-            Raycast_result rc = raycast(&state->world, state->cam_pos, state->cam_view_dir);
+            Raycast_result rc = *game_camera_ray(state);
             if (rc.collision)
             {
-                int last_chunk_x = rc.last_i >> CHUNK_DIM_LOG2;
-                int last_chunk_y = rc.last_j >> CHUNK_DIM_LOG2;
-                int last_chunk_z = rc.last_k >> CHUNK_DIM_LOG2;
-
-                Chunk *prev_chunk = 0;
-
-                Chunk *c = state->world.next;
-                while (c != 0)
+                // NOTE(max): the block in front of the hit one, it can be in a neighbour of the hit chunk
+                int block_x = rc.last_i - rc.chunk->x * CHUNK_DIM;
+                int block_y = rc.last_j - rc.chunk->y * CHUNK_DIM;
+                int block_z = rc.last_k - rc.chunk->z * CHUNK_DIM;
+
+                // NOTE(max): chunks around the camera are loaded by the streamer, edits wait until they are generated
+                Chunk *prev_chunk = chunk_neighbour_at(rc.chunk, &block_x, &block_y, &block_z);
+                if (prev_chunk && prev_chunk->generated)
                 {
-                    if ((c->x == last_chunk_x) &&
-                        (c->y == last_chunk_y) &&
-                        (c->z == last_chunk_z))
+                    if (!chunk_is_solid(prev_chunk, block_x, block_y, block_z))
                     {
-                        prev_chunk = c;
-                        break;
+                        game_set_block(state, prev_chunk, block_x, block_y, block_z, state->block_to_place);
                     }
-
-                    c = c->next;
                 }
+            }
+        }
 
-                if (!prev_chunk)
-                {
-                    prev_chunk = world_add_chunk(&state->world, &state->arena, last_chunk_x, last_chunk_y, last_chunk_z);
-                }
+        game_stream_world(state);
 
-                if (prev_chunk)
-                {
-                    int mask = ~((~1) << (CHUNK_DIM_LOG2 - 1));
-                    int block_x = rc.last_i & mask;
-                    int block_y = rc.last_j & mask;
-                    int block_z = rc.last_k & mask;
+        // NOTE(max): upload finished meshes, results of jobs that were started before the last edit
+        // or whose chunk was removed meanwhile are dropped. Jobs left over when the budget runs out wait for the next frame.
+        Mesh_pool *pool = &state->mesh_pool;
+        Rebuild_stats *rebuild_stats = &state->rebuild_stats;
+        double rebuild_start = glfwGetTime();
+        double rebuild_end = rebuild_start + state->rebuild_budget_us * 1e-6;
+        rebuild_stats->uploads = 0;
+        rebuild_stats->submits = 0;
 
-                    int block_idx = CHUNK_DIM * CHUNK_DIM * block_y + CHUNK_DIM * block_z + block_x;
-                    if (prev_chunk->blocks[block_idx] == BLOCK_AIR)
-                    {
-                        // TODO(max): assing block type number
-                        prev_chunk->blocks[block_idx] = state->block_to_place;
-                        prev_chunk->nblocks++;
-                        world_push_chunk_for_rebuild(&state->world, prev_chunk);
-                    }
+        int done_job;
+        while ((glfwGetTime() < rebuild_end) && mesh_pool_take_done(pool, &done_job, 1))
+        {
+            Mesh_job *job = &pool->jobs[done_job];
+            Chunk *chunk = chunk_pool_get(&state->world.pool, job->chunk);
+            if (job->kind == MESH_JOB_GENERATE)
+            {
+                state->streamer.generating--;
+                state->streamer.stats.generate_us_total += job->work_us;
+                if (chunk)
+                {
+                    game_finish_generated_chunk(state, chunk, job->blocks);
                 }
+                mesh_pool_release(pool, done_job);
+                continue;
             }
-        }
 
-        Chunk *chunk_to_rebuild = 0;
-        if (state->world.rebuild_stack_top > 0)
-        {
-            chunk_to_rebuild = world_pop_chunk_for_rebuild(&state->world);
+            if (chunk && job->succeeded && (job->generation == chunk->mesh_generation))
+            {
+                double upload_start = glfwGetTime();
+                chunk_upload_mesh(state->chunk_buffers, chunk, &job->result);
+                chunk->uploaded_generation = job->generation;
+                chunk->face_links = job->face_links;
+                shadow_cascades_chunk_changed(state, chunk);
+                rebuild_stats->upload_us_total += (glfwGetTime() - upload_start) * 1e6;
+                rebuild_stats->uploads++;
+                rebuild_stats->chunks_uploaded++;
+            }
+            rebuild_stats->chunks_meshed++;
+            rebuild_stats->mesh_us_total += job->work_us;
+            mesh_pool_release(pool, done_job);
         }
 
-        if (chunk_to_rebuild && chunk_to_rebuild->nblocks)
+        // NOTE(max): chunks in view of the last frame go first, nearest first
+        while ((pool->nfree > 0) && (glfwGetTime() < rebuild_end))
         {
-            Memory_arena arena = {};
-            arena.curr = (uint8_t *)memory->transient_mem;
-            arena.end  = (uint8_t *)memory->transient_mem + memory->transient_mem_size;
-        
-            Range3d *ranges  = (Range3d *)memory_arena_alloc(&arena, BLOCKS_IN_CHUNK * sizeof(Range3d));
-            uint8_t *visited = (uint8_t *)memory_arena_alloc(&arena, BLOCKS_IN_CHUNK * sizeof(uint8_t));
-            if (ranges && visited)
+            Chunk *chunks_to_rebuild[MESH_JOB_COUNT];
+            int nchunks_to_rebuild = world_pop_chunks_for_rebuild(&state->world, &state->camera_frustum, state->cam_pos,
+                                                                  &state->frame_arena, chunks_to_rebuild, pool->nfree);
+            if (nchunks_to_rebuild == 0)
             {
-                for (int i = 0; i < (BLOCKS_IN_CHUNK); i++) visited[i] = 0;
-             
-                int nranges = 0;
-                gen_ranges_3d(chunk_to_rebuild->blocks, ranges, visited, CHUNK_DIM, chunk_to_rebuild->nblocks, &nranges);
-
-                // NOTE(max): sort ranges by block type
-                for (int i = 0; i < nranges - 1; i++)
-                {
-                    for (int j = 0; j < nranges - i - 1; j++)
-                    {
-                        if (ranges[j].type > ranges[j + 1].type)
-                        {
-                            Range3d temp = ranges[j + 1];
-                            ranges[j + 1] = ranges[j];
-                            ranges[j] = temp;
-                        }
-                    }
-                }
+                break;
+            }
 
-                int rebuilded_mesh_types[BLOCK_TYPE_COUNT] = {};
+            for (int i = 0; i < nchunks_to_rebuild; i++)
+            {
+                Chunk *chunk_to_rebuild = chunks_to_rebuild[i];
+                chunk_to_rebuild->mesh_generation++;
 
-                int ranges_left = nranges;
-                int ranges_idx_start = 0;
-                int ranges_idx_end  = 0;
-                void *arena_cursor = memory_arena_get_cursor(&arena);
-                while (ranges_left > 0)
+                if (chunk_to_rebuild->nblocks)
                 {
-                    memory_arena_set_cursor(&arena, arena_cursor);
-
-                    int ranges_count = 0;
-                    uint8_t range_type = ranges[ranges_idx_start].type;
-                    while ((ranges_idx_end < nranges) && ranges[ranges_idx_end].type == range_type)
-                    {
-                        ranges_count++;
-                        ranges_idx_end++;
-                    }
-                    ranges_left -= ranges_count;
-
-                    assert(range_type < BLOCK_TYPE_COUNT);
-                    Mesh *mesh_to_rebuild = &chunk_to_rebuild->meshes[range_type];
-
-                    int vs_arr_size = 3 * 12 * ranges_count * sizeof(Vec3f);
-                    int ns_arr_size = 3 * 12 * ranges_count * sizeof(Vec3f);
-                    Vec3f *vs = (Vec3f *)memory_arena_alloc(&arena, vs_arr_size + ns_arr_size);
-                    printf("%p\n", vs);
-                    Vec3f *ns = vs + (3 * 12 * ranges_count);
-                    if (vs)
-                    {
-                        rebuilded_mesh_types[range_type] = 1;
-
-                        int v_idx = 0;
-                        mesh_to_rebuild->num_of_vs = 3 * 12 * ranges_count;
-                        for (int i = ranges_idx_start; i < ranges_idx_end; i++)
-                        {
-                            Vec3f base((float)ranges[i].start_x, (float)ranges[i].start_y, (float)ranges[i].start_z);
-
-                            float dim_x = (float)ranges[i].end_x - base.x + 1.0f;
-                            float dim_y = (float)ranges[i].end_y - base.y + 1.0f;
-                            float dim_z = (float)ranges[i].end_z - base.z + 1.0f;
-
-                            // TODO(max): check for correct winding order
-
-                            Vec3f bottom_n(0, -1, 0);
-                            Vec3f top_n(0, 1, 0);
-                            Vec3f north_n(0, 0, -1);
-                            Vec3f south_n(0, 0, 1);
-                            Vec3f west_n(-1, 0, 0);
-                            Vec3f east_n(1, 0, 0);
-
-                            // bottom tri 0
-                            vs[v_idx + 0 * 3 + 0] = base;
-                            vs[v_idx + 0 * 3 + 1] = base + Vec3f(dim_x, 0, 0);
-                            vs[v_idx + 0 * 3 + 2] = base + Vec3f(0, 0, dim_z);
-
-                            ns[v_idx + 0 * 3 + 0] = bottom_n;
-                            ns[v_idx + 0 * 3 + 1] = bottom_n;
-                            ns[v_idx + 0 * 3 + 2] = bottom_n;
-
-                            // bottom tri 1
-                            vs[v_idx + 1 * 3 + 0] = base + Vec3f(0, 0, dim_z);
-                            vs[v_idx + 1 * 3 + 1] = base + Vec3f(dim_x, 0, 0);
-                            vs[v_idx + 1 * 3 + 2] = base + Vec3f(dim_x, 0, dim_z);
-
-                            ns[v_idx + 1 * 3 + 0] = bottom_n;
-                            ns[v_idx + 1 * 3 + 1] = bottom_n;
-                            ns[v_idx + 1 * 3 + 2] = bottom_n;
-
-                            // top tri 0
-                            vs[v_idx + 2 * 3 + 0] = base + Vec3f(0, dim_y, 0);
-                            vs[v_idx + 2 * 3 + 1] = base + Vec3f(0, dim_y, dim_z);
-                            vs[v_idx + 2 * 3 + 2] = base + Vec3f(dim_x, dim_y, 0);
-
-                            ns[v_idx + 2 * 3 + 0] = top_n;
-                            ns[v_idx + 2 * 3 + 1] = top_n;
-                            ns[v_idx + 2 * 3 + 2] = top_n;
-
-                            // top tri 1
-                            vs[v_idx + 3 * 3 + 0] = base + Vec3f(0, dim_y, dim_z);
-                            vs[v_idx + 3 * 3 + 1] = base + Vec3f(dim_x, dim_y, dim_z);
-                            vs[v_idx + 3 * 3 + 2] = base + Vec3f(dim_x, dim_y, 0);
-
-                            ns[v_idx + 3 * 3 + 0] = top_n;
-                            ns[v_idx + 3 * 3 + 1] = top_n;
-                            ns[v_idx + 3 * 3 + 2] = top_n;
-
-                            // north tri 0
-                            vs[v_idx + 4 * 3 + 0] = base;
-                            vs[v_idx + 4 * 3 + 1] = base + Vec3f(0, dim_y, 0);
-                            vs[v_idx + 4 * 3 + 2] = base + Vec3f(dim_x, dim_y, 0);
-
-                            ns[v_idx + 4 * 3 + 0] = north_n;
-                            ns[v_idx + 4 * 3 + 1] = north_n;
-                            ns[v_idx + 4 * 3 + 2] = north_n;
-
-                            // north tri 1
-                            vs[v_idx + 5 * 3 + 0] = base;
-                            vs[v_idx + 5 * 3 + 1] = base + Vec3f(dim_x, dim_y, 0);
-                            vs[v_idx + 5 * 3 + 2] = base + Vec3f(dim_x, 0, 0);
-
-                            ns[v_idx + 5 * 3 + 0] = north_n;
-                            ns[v_idx + 5 * 3 + 1] = north_n;
-                            ns[v_idx + 5 * 3 + 2] = north_n;
-
-                            // south tri 0
-                            vs[v_idx + 6 * 3 + 0] = base + Vec3f(0, 0, dim_z);
-                            vs[v_idx + 6 * 3 + 1] = base + Vec3f(dim_x, dim_y, dim_z);
-                            vs[v_idx + 6 * 3 + 2] = base + Vec3f(0, dim_y, dim_z);
-
-                            ns[v_idx + 6 * 3 + 0] = south_n;
-                            ns[v_idx + 6 * 3 + 1] = south_n;
-                            ns[v_idx + 6 * 3 + 2] = south_n;
-
-                            // south tri 1
-                            vs[v_idx + 7 * 3 + 0] = base + Vec3f(0, 0, dim_z);
-                            vs[v_idx + 7 * 3 + 1] = base + Vec3f(dim_x, 0, dim_z);
-                            vs[v_idx + 7 * 3 + 2] = base + Vec3f(dim_x, dim_y, dim_z);
-
-                            ns[v_idx + 7 * 3 + 0] = south_n;
-                            ns[v_idx + 7 * 3 + 1] = south_n;
-                            ns[v_idx + 7 * 3 + 2] = south_n;
-
-                            // west tri 0
-                            vs[v_idx + 8 * 3 + 0] = base;
-                            vs[v_idx + 8 * 3 + 1] = base + Vec3f(0, dim_y, dim_z);
-                            vs[v_idx + 8 * 3 + 2] = base + Vec3f(0, dim_y, 0);
-
-                            ns[v_idx + 8 * 3 + 0] = west_n;
-                            ns[v_idx + 8 * 3 + 1] = west_n;
-                            ns[v_idx + 8 * 3 + 2] = west_n;
-
-                            // west tri 1
-                            vs[v_idx + 9 * 3 + 0] = base;
-                            vs[v_idx + 9 * 3 + 1] = base + Vec3f(0, 0, dim_z);
-                            vs[v_idx + 9 * 3 + 2] = base + Vec3f(0, dim_y, dim_z);
-
-                            ns[v_idx + 9 * 3 + 0] = west_n;
-                            ns[v_idx + 9 * 3 + 1] = west_n;
-                            ns[v_idx + 9 * 3 + 2] = west_n;
-
-                            // east tri 0
-                            vs[v_idx + 10 * 3 + 0] = base + Vec3f(dim_x, 0, 0);
-                            vs[v_idx + 10 * 3 + 1] = base + Vec3f(dim_x, dim_y, 0);
-                            vs[v_idx + 10 * 3 + 2] = base + Vec3f(dim_x, dim_y, dim_z);
-
-                            ns[v_idx + 10 * 3 + 0] = east_n;
-                            ns[v_idx + 10 * 3 + 1] = east_n;
-                            ns[v_idx + 10 * 3 + 2] = east_n;
-
-                            // east tri 1
-                            vs[v_idx + 11 * 3 + 0] = base + Vec3f(dim_x, 0, 0);
-                            vs[v_idx + 11 * 3 + 1] = base + Vec3f(dim_x, dim_y, dim_z);
-                            vs[v_idx + 11 * 3 + 2] = base + Vec3f(dim_x, 0, dim_z);
-
-                            ns[v_idx + 11 * 3 + 0] = east_n;
-                            ns[v_idx + 11 * 3 + 1] = east_n;
-                            ns[v_idx + 11 * 3 + 2] = east_n;
-
-                            v_idx += (3 * 12);
-                        }
-
-                        assert(v_idx == mesh_to_rebuild->num_of_vs);
-
-                        if (mesh_to_rebuild->vao == 0)
-                        {
-                            assert((mesh_to_rebuild->vao == 0) && (mesh_to_rebuild->vbo == 0));
-                            glGenVertexArrays(1, &mesh_to_rebuild->vao);
-                            glGenBuffers(1, &mesh_to_rebuild->vbo);
-                        }
-
-                        glBindVertexArray(mesh_to_rebuild->vao);
-                        glBindBuffer(GL_ARRAY_BUFFER, mesh_to_rebuild->vbo);
-
-                        glBufferData(GL_ARRAY_BUFFER, vs_arr_size + ns_arr_size, vs, GL_STREAM_DRAW);
-                        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, (void *)0);
-                        glEnableVertexAttribArray(0);
-                        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(float) * 3, (char *)(0) + vs_arr_size);
-                        glEnableVertexAttribArray(1);
-
-                        glBindVertexArray(0);
-                        glBindBuffer(GL_ARRAY_BUFFER, 0);
-                    }
-
-                    ranges_idx_start = ranges_idx_end;
+                    mesh_pool_submit(pool, chunk_to_rebuild, state->mesher_mode, state->vertex_format);
+                    rebuild_stats->submits++;
                 }
-
-                for (int i = 0; i < BLOCK_TYPE_COUNT; i++)
+                else
                 {
-                    if (rebuilded_mesh_types[i] == 0)
-                    {
-                        Mesh *m = &chunk_to_rebuild->meshes[i];
-                        if (m->vao != 0)
-                        {
-                            assert(m->vao && m->vbo);
-
-                            glDeleteVertexArrays(1, &m->vao);
-                            glDeleteBuffers(1, &m->vbo);
-
-                            m->num_of_vs = 0;
-                            m->vao = 0;
-                            m->vbo = 0;
-                        }
-                    }
+                    chunk_delete_mesh(state->chunk_buffers, chunk_to_rebuild);
+                    chunk_to_rebuild->uploaded_generation = chunk_to_rebuild->mesh_generation;
+                    chunk_to_rebuild->face_links = FACE_LINKS_ALL;
+                    shadow_cascades_chunk_changed(state, chunk_to_rebuild);
                 }
             }
         }
-        else if (chunk_to_rebuild && !chunk_to_rebuild->nblocks)
-        {
-            for (int i = 0; i < BLOCK_TYPE_COUNT; i++)
-            {
-                Mesh *m = &chunk_to_rebuild->meshes[i];
-                if (m->vao != 0)
-                {
-                    assert(m->vao && m->vbo);
 
-                    glDeleteVertexArrays(1, &m->vao);
-                    glDeleteBuffers(1, &m->vbo);
+        double rebuild_now = glfwGetTime();
+        rebuild_stats->frame_us = (rebuild_now - rebuild_start) * 1e6;
 
-                    m->num_of_vs = 0;
-                    m->vao = 0;
-                    m->vbo = 0;
-                }
-            }
+        bool rebuilding = (state->world.rebuild_queue_count > 0) || (pool->nfree < MESH_JOB_COUNT);
+        if (rebuilding && !rebuild_stats->cleaning)
+        {
+            rebuild_stats->cleaning = true;
+            rebuild_stats->cleaning_since = rebuild_start;
+        }
+        else if (!rebuilding && rebuild_stats->cleaning)
+        {
+            rebuild_stats->cleaning = false;
+            rebuild_stats->last_time_to_clean_ms = (rebuild_now - rebuild_stats->cleaning_since) * 1e3;
         }
     }
     
@@ -1169,43 +7045,89 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
         glClearColor(0.75f, 0.96f, 0.9f, 1);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
+		state->render_stats.draw_calls = 0;
+
 		glm::vec3 sunPosition(20 * sin(-20 + glfwGetTime() * 0.1), 20 * cos(0.002 - 20 + glfwGetTime() * 0.1), 20 * sin(glfwGetTime() * 0.1));
 		float sunHeight = glm::dot(glm::normalize(sunPosition), glm::vec3(0.0f, 1.0f, 0.0f));
 		float ambient = std::max(sunHeight / 2, 0.3f);
 
 		//Shadow maps
 		glm::vec3 cameraPos(state->cam_pos.x, state->cam_pos.y, state->cam_pos.z);
-		glm::mat4 lightView = glm::lookAt(sunPosition + cameraPos, cameraPos, glm::vec3(0.0f, 1.0f, 0.0f));
-		glm::mat4 lightProjection1 = glm::ortho(-10.0f, 10.0f, -10.0f, 10.0f, 1.0f, 200.0f);
-		glm::mat4 lightProjection2 = glm::ortho(-20.0f, 20.0f, -20.0f, 20.0f, 1.0f, 200.0f);
-		glm::mat4 lightProjection3 = glm::ortho(-40.0f, 40.0f, -40.0f, 40.0f, 1.0f, 200.0f);
-		glm::mat4 lightProjection4 = glm::ortho(-80.0f, 80.0f, -80.0f, 80.0f, 1.0f, 200.0f);
-		glm::mat4 lightProjectionViewMatrix1 = lightProjection1 * lightView;
-		glm::mat4 lightProjectionViewMatrix2 = lightProjection2 * lightView;
-		glm::mat4 lightProjectionViewMatrix3 = lightProjection3 * lightView;
-		glm::mat4 lightProjectionViewMatrix4 = lightProjection4 * lightView;
+		glm::vec3 lightDir = glm::normalize(sunPosition);
+
+		Chunk_bounds chunkBounds;
+		// NOTE(max): out of frame memory no chunk is drawn and the cascades keep their old maps
+		bool chunkBoundsBuilt = chunk_bounds_build(&state->world, &state->frame_arena, &chunkBounds);
+		if (!chunkBoundsBuilt)
+			chunkBounds.count = 0;
+
+		bool updateCascade[SHADOW_CASCADE_COUNT];
+		glm::vec3 cascadeCenters[SHADOW_CASCADE_COUNT];
+		for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+			Shadow_cascade *cascade = &state->shadow_cascades[i];
+			float step = (2.0f * Shadow_cascade_extents[i] / SHADOW_MAP_SIZE) * SHADOW_SNAP_TEXELS;
+			cascadeCenters[i] = glm::floor(cameraPos / step) * step;
+
+			updateCascade[i] = chunkBoundsBuilt && (!cascade->valid || cascade->dirty || (cascadeCenters[i] != cascade->center) ||
+				(glm::dot(lightDir, cascade->light_dir) < cosf(TO_RADIANS(SHADOW_LIGHT_THRESHOLD_DEG))));
+		}
 
-		state->meshShadowMapSP.use();
+		// NOTE(max): far cascades take turns, one of them per frame. Ones that were never rendered go right away.
+		bool staggeredUpdated = false;
+		for (int n = 0; n < SHADOW_CASCADE_COUNT - SHADOW_FIRST_STAGGERED_CASCADE; n++) {
+			int i = SHADOW_FIRST_STAGGERED_CASCADE +
+				(state->next_staggered_cascade + n) % (SHADOW_CASCADE_COUNT - SHADOW_FIRST_STAGGERED_CASCADE);
+			if (!updateCascade[i] || !state->shadow_cascades[i].valid)
+				continue;
 
-		state->shadowMap1.bind();
-		state->meshShadowMapSP.setMatrix4fv("u_projection_view", lightProjectionViewMatrix1);
-		renderWorld(state, state->meshShadowMapSP);
-		state->shadowMap1.unbind();
+			if (staggeredUpdated) {
+				updateCascade[i] = false;
+			}
+			else {
+				staggeredUpdated = true;
+				state->next_staggered_cascade = i - SHADOW_FIRST_STAGGERED_CASCADE + 1;
+			}
+		}
 
-		state->shadowMap2.bind();
-		state->meshShadowMapSP.setMatrix4fv("u_projection_view", lightProjectionViewMatrix2);
-		renderWorld(state, state->meshShadowMapSP);
-		state->shadowMap2.unbind();
+		ShadowMap *shadowMaps[SHADOW_CASCADE_COUNT] = { &state->shadowMap1, &state->shadowMap2, &state->shadowMap3, &state->shadowMap4 };
+		state->meshShadowMapSP.use();
 
-		state->shadowMap3.bind();
-		state->meshShadowMapSP.setMatrix4fv("u_projection_view", lightProjectionViewMatrix3);
-		renderWorld(state, state->meshShadowMapSP);
-		state->shadowMap3.unbind();
+		for (int i = 0; i < SHADOW_CASCADE_COUNT; i++) {
+			Render_pass pass = (Render_pass)(RENDER_PASS_SHADOW_1 + i);
+			if (!memory->shadow_maps) {
+				state->render_stats.drawn[pass] = 0;
+				state->render_stats.culled[pass] = 0;
+				state->render_stats.cached[pass] = false;
+				continue;
+			}
+			state->render_stats.cached[pass] = !updateCascade[i];
+			if (!updateCascade[i])
+				continue;
+
+			Shadow_cascade *cascade = &state->shadow_cascades[i];
+			float extent = Shadow_cascade_extents[i];
+			glm::vec3 center = cascadeCenters[i];
+			glm::mat4 lightView = glm::lookAt(sunPosition + center, center, glm::vec3(0.0f, 1.0f, 0.0f));
+			glm::mat4 lightProjection = glm::ortho(-extent, extent, -extent, extent, 1.0f, 200.0f);
+
+			cascade->valid = true;
+			cascade->center = center;
+			cascade->dirty = false;
+			cascade->light_dir = lightDir;
+			cascade->projection_view = lightProjection * lightView;
+			frustum_from_matrix(&cascade->frustum, cascade->projection_view);
+
+			shadowMaps[i]->bind();
+			state->meshShadowMapSP.setMatrix4fv("u_projection_view", cascade->projection_view);
+			renderVisibleWorld(state, state->meshShadowMapSP, &chunkBounds, cascade->projection_view, pass);
+			shadowMaps[i]->unbind();
+			state->render_stats.shadow_updates++;
+		}
 
-		state->shadowMap4.bind();
-		state->meshShadowMapSP.setMatrix4fv("u_projection_view", lightProjectionViewMatrix4);
-		renderWorld(state, state->meshShadowMapSP);
-		state->shadowMap4.unbind();
+		glm::mat4 lightProjectionViewMatrix1 = state->shadow_cascades[0].projection_view;
+		glm::mat4 lightProjectionViewMatrix2 = state->shadow_cascades[1].projection_view;
+		glm::mat4 lightProjectionViewMatrix3 = state->shadow_cascades[2].projection_view;
+		glm::mat4 lightProjectionViewMatrix4 = state->shadow_cascades[3].projection_view;
 
 		//World
         state->mesh_sp.use();
@@ -1237,6 +7159,7 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
 		state->mesh_sp.setMatrix4fv("lightSpaceMatrix3", lightProjectionViewMatrix3);
 		state->mesh_sp.setMatrix4fv("lightSpaceMatrix4", lightProjectionViewMatrix4);
 		glUniform1f(glGetUniformLocation(state->mesh_sp.get(), "shadowStrength"), (sunHeight > 0.5f ? 1.0f : std::max(sunHeight * 2.0f, 0.0f)));
+		glUniform1i(glGetUniformLocation(state->mesh_sp.get(), "u_shadow_maps"), memory->shadow_maps);
 
 		if (sunHeight > 0.2f)
 			state->mesh_sp.set1f("diffuse_strength", 1.0f);
@@ -1251,10 +7174,18 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
 			state->mesh_sp.set3fv("light_pos", -sunPosition);
 		}
 
-		renderWorld(state, state->mesh_sp);
+		glm::mat4 cameraProjection, cameraView;
+		for (int x = 0; x < 4; ++x)
+			for (int y = 0; y < 4; ++y) {
+				cameraProjection[x][y] = projection.m[x][y];
+				cameraView[x][y] = view.m[x][y];
+			}
+		glm::mat4 cameraProjectionView = cameraProjection * cameraView;
+		frustum_from_matrix(&state->camera_frustum, cameraProjectionView);
+		renderVisibleWorld(state, state->mesh_sp, &chunkBounds, cameraProjectionView, RENDER_PASS_CAMERA);
 
 
-		Raycast_result rc = raycast(&state->world, state->cam_pos, state->cam_view_dir);
+		Raycast_result rc = *game_camera_ray(state);
 		if (rc.collision) {
 			glm::mat4 model(1);
 			model = glm::translate(model, glm::vec3(rc.i + 0.5f, rc.j + 0.5f, rc.k + 0.5f));
@@ -1267,6 +7198,9 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
 			
 			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 			state->mesh_sp.setMatrix4fv("u_model", model);
+			glUniform1i(glGetUniformLocation(state->mesh_sp.get(), "u_packed_vertices"), 0);
+			glUniform1i(glGetUniformLocation(state->mesh_sp.get(), "u_use_block_colors"), 0);
+			glUniform1i(glGetUniformLocation(state->mesh_sp.get(), "u_use_page_offsets"), 0);
 			glUniform3f(glGetUniformLocation(state->mesh_sp.get(), "u_color"), 0.0f, 0.0f, 0.0f);
 			glDrawArrays(GL_TRIANGLES, 0, 36);
 			glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
@@ -1392,16 +7326,414 @@ void game_update_and_render(Game_input *input, Game_memory *memory)
 		glEnable(GL_DEPTH_TEST);
 		glBindVertexArray(0);
     }
+
+    memory_arena_set_cursor(&state->frame_arena, frame_start);
+}
+
+// NOTE(max): the permanent memory written out as it is, it loads back at the same address so pointers into it
+// stay valid. Anything the memory refers to outside of it (threads, GL objects, open files, the transient memory)
+// is made again after loading. Chunk meshes are read back from the GPU and stored after the memory, so loading
+// does not remesh the world. A snapshot only loads into the build that wrote it.
+#define SNAPSHOT_MAGIC 0x50534E53u // "SNSP"
+#define SNAPSHOT_VERSION 4
+// NOTE(max): the memory starts at a multiple of the page size and the windows allocation granularity
+#define SNAPSHOT_MEMORY_OFFSET MEMORY_KB(64)
+#define SNAPSHOT_BUILD (__DATE__ " " __TIME__)
+
+struct Snapshot_header
+{
+    uint32_t magic;
+    uint32_t version;
+    char build[32];
+    uint64_t game_state_size;
+    uint64_t base;
+    uint64_t memory_size;
+    uint64_t meshes_offset;
+    uint32_t nmeshes;
+};
+
+struct Snapshot_mesh
+{
+    uint32_t pool_index;
+    uint32_t generation;
+    uint32_t format;
+    uint32_t num_of_vs;
+    // NOTE(max): of the vertices that follow, padded to 8 bytes
+    uint32_t size;
+    uint32_t pad;
+};
+
+void game_snapshot_path(const char *world_dir, char *out)
+{
+    snprintf(out, REGION_PATH_MAX, "%s/snapshot.bin", world_dir);
+}
+
+bool game_save_snapshot(Game_memory *memory, Game_state *state, const char *path)
+{
+    platform_make_directory(state->regions.dir);
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        return (false);
+    }
+
+    Snapshot_header header = {};
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    snprintf(header.build, sizeof(header.build), "%s", SNAPSHOT_BUILD);
+    header.game_state_size = sizeof(Game_state);
+    header.base = (uint64_t)memory->permanent_mem;
+    header.memory_size = memory_arena_committed_size(&state->arena, memory->permanent_mem);
+    header.meshes_offset = SNAPSHOT_MEMORY_OFFSET + header.memory_size;
+
+    bool ok = (fseek(file, (long)SNAPSHOT_MEMORY_OFFSET, SEEK_SET) == 0) &&
+        (fwrite(memory->permanent_mem, 1, (size_t)header.memory_size, file) == header.memory_size);
+
+    for (Chunk *c = state->world.next; ok && c; c = c->next)
+    {
+        if (c->mesh.npages == 0)
+        {
+            continue;
+        }
+
+        Gpu_buffer *b = &state->chunk_buffers[c->mesh.format];
+        uint32_t vertex_size = b->vertex_size;
+        Snapshot_mesh m = {};
+        m.pool_index = c->pool_index;
+        m.generation = c->generation;
+        m.format = c->mesh.format;
+        m.num_of_vs = (uint32_t)c->mesh.num_of_vs;
+        m.size = (uint32_t)ALIGN_UP(m.num_of_vs * vertex_size, 8);
+
+        void *cursor = memory_arena_get_cursor(&state->frame_arena);
+        void *vs = memory_arena_alloc(&state->frame_arena, m.size);
+        ok = vs != 0;
+        if (ok)
+        {
+            glBindBuffer(GL_ARRAY_BUFFER, b->vbo);
+            glGetBufferSubData(GL_ARRAY_BUFFER, (GLintptr)c->mesh.first_page * GPU_PAGE_VERTICES * vertex_size,
+                               m.num_of_vs * vertex_size, vs);
+            ok = (fwrite(&m, sizeof(m), 1, file) == 1) && (fwrite(vs, 1, m.size, file) == m.size);
+        }
+        memory_arena_set_cursor(&state->frame_arena, cursor);
+        header.nmeshes++;
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    ok = ok && (fseek(file, 0, SEEK_SET) == 0) && (fwrite(&header, sizeof(header), 1, file) == 1);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok)
+    {
+        remove(path);
+    }
+    return (ok);
+}
+
+// NOTE(max): false if there is no usable snapshot, memory is untouched then
+bool game_load_snapshot(Game_memory *memory, const char *path)
+{
+    assert(!memory->is_initialized);
+
+    uint64_t file_size;
+    uint8_t *file = (uint8_t *)platform_map_file(path, &file_size);
+    if (!file)
+    {
+        return (false);
+    }
+
+    Snapshot_header header;
+    bool usable = file_size >= sizeof(header);
+    if (usable)
+    {
+        memcpy(&header, file, sizeof(header));
+        usable = (header.magic == SNAPSHOT_MAGIC) && (header.version == SNAPSHOT_VERSION) &&
+            (strncmp(header.build, SNAPSHOT_BUILD, sizeof(header.build)) == 0) &&
+            (header.game_state_size == sizeof(Game_state)) && (header.base == (uint64_t)memory->permanent_mem) &&
+            (header.memory_size <= memory->permanent_mem_size) && (header.meshes_offset <= file_size);
+    }
+    if (!usable)
+    {
+        printf("snapshot: %s was written by another build or at another address, ignoring it\n", path);
+        platform_unmap_file(file, file_size);
+        return (false);
+    }
+
+    double start = glfwGetTime();
+    if (!platform_map_file_private(path, SNAPSHOT_MEMORY_OFFSET, memory->permanent_mem, header.memory_size))
+    {
+        // NOTE(max): the memory may be half overwritten, there is no going back to a fresh start from here
+        printf("snapshot: loading %s failed\n", path);
+        exit(1);
+    }
+    double map_s = glfwGetTime() - start;
+
+    Game_state *state = (Game_state *)memory->permanent_mem;
+    memory->is_initialized = 1;
+    if (!game_init_runtime(memory, state))
+    {
+        printf("snapshot: out of transient memory\n");
+        exit(1);
+    }
+
+    // NOTE(max): work that was in flight is gone with the threads, chunks that were still generating are dropped
+    // and picked up by the streamer again, chunks whose last rebuild never got uploaded are queued again
+    state->streamer.generating = 0;
+    state->streamer.complete = false;
+    state->rebuild_stats.cleaning = false;
+    state->render_stats = {};
+    for (int i = 0; i < SHADOW_CASCADE_COUNT; i++)
+    {
+        state->shadow_cascades[i].valid = false;
+    }
+    region_cache_reset(&state->regions);
+
+    Chunk *c = state->world.next;
+    while (c)
+    {
+        Chunk *next = c->next;
+        c->mesh.num_of_vs = 0;
+        c->mesh.first_page = 0;
+        c->mesh.npages = 0;
+        if (!c->generated)
+        {
+            world_remove_chunk(&state->world, c);
+        }
+        c = next;
+    }
+
+    uint32_t nmeshes = 0;
+    uint64_t offset = header.meshes_offset;
+    for (uint32_t i = 0; i < header.nmeshes; i++)
+    {
+        Snapshot_mesh m;
+        if (offset + sizeof(m) > file_size)
+        {
+            break;
+        }
+        memcpy(&m, file + offset, sizeof(m));
+        offset += sizeof(m);
+        if (offset + m.size > file_size)
+        {
+            break;
+        }
+
+        Chunk_handle handle = {m.pool_index, m.generation};
+        Chunk *chunk = chunk_pool_get(&state->world.pool, handle);
+        if (chunk)
+        {
+            Chunk_mesh_data data;
+            data.format = (Vertex_format)m.format;
+            data.num_of_vs = (int)m.num_of_vs;
+            data.max_vs = (int)m.num_of_vs;
+            data.vs = file + offset;
+            chunk_upload_mesh(state->chunk_buffers, chunk, &data);
+            nmeshes++;
+        }
+        offset += m.size;
+    }
+    platform_unmap_file(file, file_size);
+
+    // NOTE(max): a snapshot is used once, after a crash the next start goes back to the region files
+    remove(path);
+
+    for (c = state->world.next; c; c = c->next)
+    {
+        if (c->nblocks && (c->uploaded_generation != c->mesh_generation))
+        {
+            world_push_chunk_for_rebuild(&state->world, &state->arena, c);
+        }
+    }
+
+    printf("snapshot: %.1f MB at %p in %.1f ms, %d chunks and %u meshes ready in %.1f ms\n",
+        header.memory_size / (1024.0 * 1024.0), memory->permanent_mem, map_s * 1e3, state->world.nchunks, nmeshes,
+        (glfwGetTime() - start) * 1e3);
+    return (true);
+}
+
+void game_shutdown(Game_memory *memory)
+{
+    assert(memory->is_initialized);
+    Game_state *state = (Game_state *)memory->permanent_mem;
+
+    job_system_shutdown(&state->job_system);
+
+    for (Chunk *c = state->world.next; c; c = c->next)
+    {
+        if (c->modified && !game_save_chunk(state, c))
+        {
+            printf("regions: saving chunk %d %d %d failed\n", c->x, c->y, c->z);
+        }
+    }
+    region_cache_close_all(&state->regions);
+
+    char snapshot_path[REGION_PATH_MAX];
+    game_snapshot_path(state->regions.dir, snapshot_path);
+    if (!game_save_snapshot(memory, state, snapshot_path))
+    {
+        printf("snapshot: writing %s failed\n", snapshot_path);
+    }
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
+    uint32_t terrain_seed = DEFAULT_TERRAIN_SEED;
+    bool bench_index = false;
+    bool bench_mesher = false;
+    bool bench_occupancy = false;
+    bool bench_terrain = false;
+    bool bench_jobs = false;
+    bool bench_regions = false;
+    bool bench_raycast = false;
+    bool bench_light = false;
+    const char *world_dir = "world";
+    bool use_snapshot = true;
+    bool shadow_maps = false;
+    Mesher_mode mesher_mode = DEFAULT_MESHER_MODE;
+    Vertex_format vertex_format = DEFAULT_VERTEX_FORMAT;
+    double rebuild_budget_us = DEFAULT_REBUILD_BUDGET_US;
+    int stream_radius = DEFAULT_STREAM_RADIUS;
+    for (int i = 1; i < argc; i++)
+    {
+        if ((strcmp(argv[i], "-seed") == 0) && (i + 1 < argc))
+        {
+            terrain_seed = (uint32_t)strtoul(argv[++i], 0, 10);
+        }
+        else if (strcmp(argv[i], "-bench_index") == 0)
+        {
+            bench_index = true;
+        }
+        else if (strcmp(argv[i], "-bench_mesher") == 0)
+        {
+            bench_mesher = true;
+        }
+        else if (strcmp(argv[i], "-bench_occupancy") == 0)
+        {
+            bench_occupancy = true;
+        }
+        else if (strcmp(argv[i], "-bench_terrain") == 0)
+        {
+            bench_terrain = true;
+        }
+        else if (strcmp(argv[i], "-bench_jobs") == 0)
+        {
+            bench_jobs = true;
+        }
+        else if (strcmp(argv[i], "-bench_regions") == 0)
+        {
+            bench_regions = true;
+        }
+        else if (strcmp(argv[i], "-bench_raycast") == 0)
+        {
+            bench_raycast = true;
+        }
+        else if (strcmp(argv[i], "-bench_light") == 0)
+        {
+            bench_light = true;
+        }
+        else if ((strcmp(argv[i], "-world") == 0) && (i + 1 < argc))
+        {
+            world_dir = argv[++i];
+        }
+        else if (strcmp(argv[i], "-no_snapshot") == 0)
+        {
+            use_snapshot = false;
+        }
+        else if (strcmp(argv[i], "-shadow_maps") == 0)
+        {
+            shadow_maps = true;
+        }
+        else if ((strcmp(argv[i], "-mesher") == 0) && (i + 1 < argc))
+        {
+            i++;
+            if (strcmp(argv[i], "volume") == 0)
+            {
+                mesher_mode = MESHER_VOLUME;
+            }
+            else if (strcmp(argv[i], "surface") == 0)
+            {
+                mesher_mode = MESHER_SURFACE;
+            }
+            else if (strcmp(argv[i], "greedy") == 0)
+            {
+                mesher_mode = MESHER_GREEDY;
+            }
+        }
+        else if ((strcmp(argv[i], "-rebuild_budget_us") == 0) && (i + 1 < argc))
+        {
+            // NOTE(max): with no budget at all no chunk would ever be rebuilt
+            double budget_us = strtod(argv[++i], 0);
+            if (budget_us > 0.0)
+            {
+                rebuild_budget_us = budget_us;
+            }
+        }
+        else if ((strcmp(argv[i], "-stream_radius") == 0) && (i + 1 < argc))
+        {
+            stream_radius = std::min(std::max(atoi(argv[++i]), 0), STREAM_MAX_RADIUS);
+        }
+        else if ((strcmp(argv[i], "-vertex_format") == 0) && (i + 1 < argc))
+        {
+            i++;
+            if (strcmp(argv[i], "float") == 0)
+            {
+                vertex_format = VERTEX_FORMAT_FLOAT;
+            }
+            else if (strcmp(argv[i], "packed") == 0)
+            {
+                vertex_format = VERTEX_FORMAT_PACKED;
+            }
+        }
+    }
+
+    if (strlen(world_dir) > REGION_DIR_MAX)
+    {
+        printf("-world: the directory can be at most %d characters long\n", REGION_DIR_MAX);
+        return (-1);
+    }
 
     if (glfwInit() == GLFW_FALSE)
     {
         return (-1);
     }
 
+    if (bench_index || bench_mesher || bench_occupancy || bench_terrain || bench_jobs || bench_regions || bench_raycast || bench_light)
+    {
+        if (bench_index)
+        {
+            index_benchmark(terrain_seed);
+        }
+        if (bench_mesher)
+        {
+            mesher_benchmark(terrain_seed);
+        }
+        if (bench_occupancy)
+        {
+            occupancy_benchmark(terrain_seed);
+        }
+        if (bench_terrain)
+        {
+            terrain_benchmark(terrain_seed);
+        }
+        if (bench_jobs)
+        {
+            job_benchmark(terrain_seed);
+        }
+        if (bench_regions)
+        {
+            region_benchmark(terrain_seed, "region_bench");
+        }
+        if (bench_raycast)
+        {
+            raycast_benchmark(terrain_seed);
+        }
+        if (bench_light)
+        {
+            light_benchmark(terrain_seed);
+        }
+        glfwTerminate();
+        return (0);
+    }
+
     int window_width  = 1280;
     int window_height = 720;
  
@@ -1425,19 +7757,44 @@ int main(void)
 
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
-#define PERMANENT_MEM_SIZE MEMORY_MB(1)
-#define TRANSIENT_MEM_SIZE MEMORY_GB(1)
-
-    static uint8_t permanent_mem_blob[PERMANENT_MEM_SIZE];
-    static uint8_t transient_mem_blob[TRANSIENT_MEM_SIZE];
+// NOTE(max): only address space, pages are committed as the arenas grow
+#define PERMANENT_MEM_SIZE ((sizeof(void *) == 8) ? MEMORY_GB(64) : MEMORY_MB(512))
+// NOTE(max): snapshots only load at the address they were taken at, anywhere else is fine otherwise
+#define PERMANENT_MEM_BASE ((sizeof(void *) == 8) ? MEMORY_GB(2048) : 0)
+#define TRANSIENT_MEM_SIZE ((sizeof(void *) == 8) ? MEMORY_GB(16) : MEMORY_MB(512))
 
     Game_memory game_memory = {};
     game_memory.permanent_mem_size = PERMANENT_MEM_SIZE;
-    game_memory.permanent_mem = permanent_mem_blob;
+    game_memory.permanent_mem = platform_reserve_memory_at((void *)PERMANENT_MEM_BASE, PERMANENT_MEM_SIZE);
+    if (!game_memory.permanent_mem)
+    {
+        game_memory.permanent_mem = platform_reserve_memory(PERMANENT_MEM_SIZE);
+    }
     game_memory.transient_mem_size = TRANSIENT_MEM_SIZE;
-    game_memory.transient_mem = transient_mem_blob;
+    game_memory.transient_mem = platform_reserve_memory(TRANSIENT_MEM_SIZE);
+    game_memory.huge_pages = true;
+    game_memory.terrain_seed = terrain_seed;
+    game_memory.world_dir = world_dir;
+    game_memory.shadow_maps = shadow_maps;
+    game_memory.mesher_mode = mesher_mode;
+    game_memory.vertex_format = vertex_format;
+    game_memory.rebuild_budget_us = rebuild_budget_us;
+    game_memory.stream_radius = stream_radius;
+    if (!game_memory.permanent_mem || !game_memory.transient_mem)
+    {
+        glfwTerminate();
+        return (-1);
+    }
 
-    game_state_and_memory_init(&game_memory);
+    char snapshot_path[REGION_PATH_MAX];
+    game_snapshot_path(world_dir, snapshot_path);
+    if ((!use_snapshot || !game_load_snapshot(&game_memory, snapshot_path)) &&
+        !game_state_and_memory_init(&game_memory))
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return (-1);
+    }
 
     Game_input inputs[2] = {};
     Game_input *game_input = &inputs[0];
@@ -1526,6 +7883,10 @@ int main(void)
         {
             game_input->n4.is_pressed = 1;
         }
+        if (glfwGetKey(window, GLFW_KEY_5) == GLFW_PRESS)
+        {
+            game_input->n5.is_pressed = 1;
+        }
 
         game_update_and_render(game_input, &game_memory);
 
@@ -1540,6 +7901,8 @@ int main(void)
         prev_game_input = temp_input;
     }
 
+    game_shutdown(&game_memory);
+
     glfwDestroyWindow(window);
     glfwTerminate();
     return (0);
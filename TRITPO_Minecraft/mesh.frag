@@ -1,8 +1,9 @@
 #version 330 core
 
-uniform vec3 u_color;
-
 in vec3 normal;
+flat in vec3 color;
+flat in float skyLight;
+flat in float blockLight;
 in vec3 world_pos;
 in vec4 posLightSpace1;
 in vec4 posLightSpace2;
@@ -15,6 +16,7 @@ uniform vec3 light_pos;
 uniform float ambient_factor;
 uniform float diffuse_strength;
 uniform float shadowStrength;
+uniform bool u_shadow_maps;
 uniform sampler2D depthMap1;
 uniform sampler2D depthMap2;
 uniform sampler2D depthMap3;
@@ -51,21 +53,28 @@ float getShadow(vec4 posLightSpace, sampler2D depthMap) {
 	return shadow * shadowStrength;
 }
 
+const vec3 lampColor = vec3(1.0, 0.85, 0.6);
+// Caves without any light are not completely black
+const float minLight = 0.03;
+
 void main() {
     vec3 light_col = vec3(1, 1, 1);
 	float diffuse_factor = clamp(dot(normal, normalize(light_pos)), 0.0f, 1.0f);
-	float shadow;
+	float shadow = 0.0;
 	
-	if (isInShadowMap(posLightSpace1))
-		shadow = getShadow(posLightSpace1, depthMap1);
-	else if (isInShadowMap(posLightSpace2))
-		shadow = getShadow(posLightSpace2, depthMap2);
-	else if (isInShadowMap(posLightSpace3))
-		shadow = getShadow(posLightSpace3, depthMap3);
-	else
-		shadow = getShadow(posLightSpace4, depthMap4);
+	if (u_shadow_maps) {
+		if (isInShadowMap(posLightSpace1))
+			shadow = getShadow(posLightSpace1, depthMap1);
+		else if (isInShadowMap(posLightSpace2))
+			shadow = getShadow(posLightSpace2, depthMap2);
+		else if (isInShadowMap(posLightSpace3))
+			shadow = getShadow(posLightSpace3, depthMap3);
+		else
+			shadow = getShadow(posLightSpace4, depthMap4);
+	}
 
-	vec3 light = light_col * clamp(ambient_factor + diffuse_factor * diffuse_strength * (1 - shadow), 0.0f, 1.0f);
+	vec3 sun = light_col * clamp(ambient_factor + diffuse_factor * diffuse_strength * (1 - shadow), 0.0f, 1.0f);
+	vec3 light = max(max(sun * skyLight, lampColor * blockLight), vec3(minLight));
 
-    frag_color = vec4(u_color * light, 1.0f);
+    frag_color = vec4(color * light, 1.0f);
 }
\ No newline at end of file
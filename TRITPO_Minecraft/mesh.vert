@@ -2,27 +2,74 @@
 
 layout (location = 0) in vec3 aVertexPos;
 layout (location = 1) in vec3 aVertexNormal;
+layout (location = 2) in uint aPackedVertex;
+layout (location = 3) in uint aVertexType;
+layout (location = 4) in uint aVertexLight;
 
 uniform mat4 u_projection;
 uniform mat4 u_view;
 uniform mat4 u_model;
+uniform bool u_packed_vertices;
+uniform bool u_use_block_colors;
+uniform vec3 u_color;
+// Filled from Block_colors, indexed by the block type of the vertex
+uniform vec3 u_block_colors[64];
+// Block offset of the chunk that owns each page of the chunk vertex buffer, see Gpu_buffer in main.cpp
+uniform bool u_use_page_offsets;
+uniform isamplerBuffer u_page_offsets;
 uniform mat4 lightSpaceMatrix1;
 uniform mat4 lightSpaceMatrix2;
 uniform mat4 lightSpaceMatrix3;
 uniform mat4 lightSpaceMatrix4;
 
 out vec3 normal;
+flat out vec3 color;
+// Light levels of the block in front of the face, 0..1
+flat out float skyLight;
+flat out float blockLight;
 out vec3 world_pos;
 out vec4 posLightSpace1;
 out vec4 posLightSpace2;
 out vec4 posLightSpace3;
 out vec4 posLightSpace4;
 
+// GPU_PAGE_VERTICES in main.cpp
+const int pageVertices = 256;
+
+// Same order as Face in main.cpp
+const vec3 faceNormals[6] = vec3[6](
+	vec3(0, -1, 0), vec3(0, 1, 0),
+	vec3(0, 0, -1), vec3(0, 0, 1),
+	vec3(-1, 0, 0), vec3(1, 0, 0));
+
+// Every level is 0.8 of the one above, level 0 is dark
+float lightLevel(uint level) {
+	return level == 0u ? 0.0 : pow(0.8, float(15u - level));
+}
 
 void main() {
-	gl_Position = u_projection * u_view * u_model * vec4(aVertexPos, 1.0f);
-	normal = aVertexNormal;
-	world_pos = (u_model * vec4(aVertexPos, 1.0f)).xyz;
+	vec3 vertexPos = aVertexPos;
+	vec3 vertexNormal = aVertexNormal;
+	uint vertexType = aVertexType;
+	uint vertexLight = aVertexLight;
+	if (u_packed_vertices) {
+		vertexPos = vec3(aPackedVertex & 31u, (aPackedVertex >> 5u) & 31u, (aPackedVertex >> 10u) & 31u);
+		vertexNormal = faceNormals[(aPackedVertex >> 15u) & 7u];
+		vertexType = (aPackedVertex >> 18u) & 63u;
+		vertexLight = (aPackedVertex >> 24u) & 255u;
+	}
+	if (u_use_page_offsets)
+		vertexPos += vec3(texelFetch(u_page_offsets, gl_VertexID / pageVertices).xyz);
+	color = u_use_block_colors ? u_block_colors[vertexType] : u_color;
+	// Sky light in the high 4 bits, anything that is not a chunk is lit like open sky
+	if (!u_use_block_colors)
+		vertexLight = 240u;
+	skyLight = lightLevel(vertexLight >> 4u);
+	blockLight = lightLevel(vertexLight & 15u);
+
+	gl_Position = u_projection * u_view * u_model * vec4(vertexPos, 1.0f);
+	normal = vertexNormal;
+	world_pos = (u_model * vec4(vertexPos, 1.0f)).xyz;
 
 	posLightSpace1 = lightSpaceMatrix1 * vec4(world_pos, 1.0f);
 	posLightSpace2 = lightSpaceMatrix2 * vec4(world_pos, 1.0f);
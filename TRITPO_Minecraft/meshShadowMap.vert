@@ -1,10 +1,23 @@
 #version 330 core
 
 layout (location = 0) in vec3 aVertexPos;
+layout (location = 2) in uint aPackedVertex;
 
 uniform mat4 u_projection_view;
 uniform mat4 u_model;
+uniform bool u_packed_vertices;
+// Block offset of the chunk that owns each page of the chunk vertex buffer, see Gpu_buffer in main.cpp
+uniform isamplerBuffer u_page_offsets;
+
+// GPU_PAGE_VERTICES in main.cpp
+const int pageVertices = 256;
 
 void main() {
-   gl_Position = u_projection_view * u_model * vec4(aVertexPos, 1.0f);
+	vec3 vertexPos = aVertexPos;
+	if (u_packed_vertices) {
+		vertexPos = vec3(aPackedVertex & 31u, (aPackedVertex >> 5u) & 31u, (aPackedVertex >> 10u) & 31u);
+	}
+	vertexPos += vec3(texelFetch(u_page_offsets, gl_VertexID / pageVertices).xyz);
+
+   gl_Position = u_projection_view * u_model * vec4(vertexPos, 1.0f);
 }
\ No newline at end of file